@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""
+Benchmark harness comparing the three shared-memory implementations
+(build/sobel_seq, build/sobel_par, build/sobel_task) across a matrix of
+synthetic image sizes, thread counts, and tile shapes.
+
+Each configuration gets warmup iterations plus median-of-N timed runs.
+Two files are written:
+
+  bench_summary.csv  - one row per configuration with the median sobel
+                       time and throughput (for humans and src/plot.py
+                       style consumers)
+  bench_metrics.csv  - per-phase rows in the phase3/metrics.csv schema
+                       (timestamp,latency,status,server), which
+                       phase3/performance/plotting_module.py plots
+
+Usage:
+    python3 bench.py [--sizes 512,1024,2048,4096] [--threads 1,2,4]
+                     [--reps 5] [--warmup 1] [--full]
+
+--full extends the size sweep to 8192 (slow; ~64 MB frames).
+"""
+
+import argparse
+import csv
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+
+REPO_ROOT = os.path.dirname(os.path.abspath(__file__))
+BINARIES = {
+    "sobel_seq": os.path.join(REPO_ROOT, "build", "sobel_seq"),
+    "sobel_par": os.path.join(REPO_ROOT, "build", "sobel_par"),
+    "sobel_task": os.path.join(REPO_ROOT, "build", "sobel_task"),
+}
+TILE_SHAPES = ["64x64", "256x16"]  # only sobel_task takes a tile shape
+
+PHASE_RE = re.compile(
+    r"decode=([\d.]+) sobel=([\d.]+) threshold=([\d.]+) encode=([\d.]+) total=([\d.]+)"
+)
+
+
+def make_synthetic_pgm(path, size):
+    """Deterministic gradient-plus-stripes frame; enough structure that the
+    threshold compare is not all-taken or all-skipped."""
+    row = bytearray((x * 251 + (x // 7) * 13) % 256 for x in range(size))
+    with open(path, "wb") as f:
+        f.write(b"P5\n%d %d\n255\n" % (size, size))
+        for y in range(size):
+            shift = (y * 37) % size
+            f.write(bytes(row[shift:] + row[:shift]))
+
+
+def run_once(binary, in_path, out_path, threads, tile, metrics_csv):
+    cmd = [BINARIES[binary]]
+    if tile and binary == "sobel_task":
+        cmd.append("--tile=%s" % tile)
+    if metrics_csv:
+        cmd.append("--csv=%s" % metrics_csv)
+    cmd += [in_path, out_path]
+    env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+    proc = subprocess.run(cmd, capture_output=True, text=True, env=env)
+    if proc.returncode != 0:
+        raise RuntimeError("%s failed: %s" % (" ".join(cmd), proc.stderr))
+    m = PHASE_RE.search(proc.stdout)
+    if not m:
+        raise RuntimeError("no phase timings in output of %s" % binary)
+    return {
+        "decode": float(m.group(1)),
+        "sobel": float(m.group(2)),
+        "threshold": float(m.group(3)),
+        "encode": float(m.group(4)),
+        "total": float(m.group(5)),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--sizes", default="512,1024,2048,4096")
+    parser.add_argument("--threads", default=None,
+                        help="comma list; default 1,2,4,... up to nproc")
+    parser.add_argument("--reps", type=int, default=5)
+    parser.add_argument("--warmup", type=int, default=1)
+    parser.add_argument("--full", action="store_true", help="include 8192")
+    parser.add_argument("--out-prefix", default="bench")
+    args = parser.parse_args()
+
+    sizes = [int(s) for s in args.sizes.split(",")]
+    if args.full and 8192 not in sizes:
+        sizes.append(8192)
+
+    if args.threads:
+        thread_counts = [int(t) for t in args.threads.split(",")]
+    else:
+        nproc = os.cpu_count() or 1
+        thread_counts = [t for t in (1, 2, 4, 8, 16, 32, 64) if t <= nproc]
+
+    for name, path in BINARIES.items():
+        if not os.path.exists(path):
+            sys.exit("missing %s -- run 'make' first" % path)
+
+    summary_path = args.out_prefix + "_summary.csv"
+    metrics_path = args.out_prefix + "_metrics.csv"
+    if os.path.exists(metrics_path):
+        os.remove(metrics_path)
+
+    rows = []
+    with tempfile.TemporaryDirectory(prefix="nexus_bench_") as tmp:
+        for size in sizes:
+            in_path = os.path.join(tmp, "in_%d.pgm" % size)
+            out_path = os.path.join(tmp, "out.pgm")
+            make_synthetic_pgm(in_path, size)
+            for binary in BINARIES:
+                tiles = TILE_SHAPES if binary == "sobel_task" else [None]
+                threads = thread_counts if binary != "sobel_seq" else [1]
+                for nthreads in threads:
+                    for tile in tiles:
+                        for _ in range(args.warmup):
+                            run_once(binary, in_path, out_path, nthreads, tile, None)
+                        sobel_times, totals = [], []
+                        for _ in range(args.reps):
+                            phases = run_once(binary, in_path, out_path,
+                                              nthreads, tile, metrics_path)
+                            sobel_times.append(phases["sobel"])
+                            totals.append(phases["total"])
+                        med_sobel = statistics.median(sobel_times)
+                        med_total = statistics.median(totals)
+                        mpix = size * size / 1e6
+                        rows.append({
+                            "binary": binary,
+                            "size": size,
+                            "threads": nthreads,
+                            "tile": tile or "",
+                            "median_sobel_s": "%.6f" % med_sobel,
+                            "median_total_s": "%.6f" % med_total,
+                            "sobel_mpix_s": "%.1f" % (mpix / med_sobel if med_sobel else 0),
+                        })
+                        print("%-10s size=%-5d threads=%-2d tile=%-7s "
+                              "sobel=%.6fs total=%.6fs" %
+                              (binary, size, nthreads, tile or "-",
+                               med_sobel, med_total))
+
+    with open(summary_path, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+        writer.writeheader()
+        writer.writerows(rows)
+    print("\nWrote %s (%d configurations) and %s" %
+          (summary_path, len(rows), metrics_path))
+
+
+if __name__ == "__main__":
+    main()
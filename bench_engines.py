@@ -0,0 +1,366 @@
+#!/usr/bin/env python3
+"""
+Cross-phase engine comparison: which engine wins for N images of size S?
+
+bench.py sweeps the shared-memory binaries against each other; this
+driver runs every *engine* the repo ships -- the phase 1/3 executables
+(build/sobel_seq, build/sobel_par, build/sobel_task), the persistent
+sobel_par --serve daemon that backs the phase 3 gRPC servers, the phase 2
+MPI engine (mpirun sobel_mbi), and the gRPC path itself when grpcio is
+installed -- over identical synthetic inputs, and times everything with
+ONE clock (the driver's perf_counter), end to end. That sidesteps the
+incompatible numbers the engines report internally (clock() vs
+omp_get_wtime() vs Python timestamps).
+
+Per engine and size it records:
+
+  cold   - first request on a freshly started engine (page cache cold,
+           thread pools unspun; for one-shot binaries this includes
+           process start, which is exactly what a cold request pays)
+  warm   - median of --reps further requests
+  batch  - aggregate throughput over --frames frames through the
+           engine's batch path (--batch, queue mode, or request loop)
+
+Two files are written, same split as bench.py:
+
+  engines_summary.csv  - one row per engine x size (for humans)
+  engines_metrics.csv  - rows in the phase3/metrics.csv schema
+                         (timestamp,latency,status,server) with
+                         server = "<engine>:<cold|warm|batch>", which
+                         run_analysis.py / plotting_module.py consume
+
+Engines whose prerequisites are missing (no mpirun, no grpcio) are
+skipped with a note rather than failing the sweep. The phase 1 binaries
+are also cross-checked byte-for-byte on each size; sobel_mbi rounds its
+magnitudes (round vs truncate) so it is size-checked only.
+
+Usage:
+    python3 bench_engines.py [--sizes 512,1024,2048] [--frames 8]
+                             [--reps 5] [--np 4] [--engines a,b,...]
+"""
+
+import argparse
+import csv
+import os
+import shutil
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+from bench import make_synthetic_pgm
+
+REPO_ROOT = os.path.dirname(os.path.abspath(__file__))
+BUILD = os.path.join(REPO_ROOT, "build")
+MBI_SRC = os.path.join(REPO_ROOT, "phase2", "src", "sobel_mbi.c")
+MBI_BIN = os.path.join(REPO_ROOT, "phase2", "src", "sobel_mbi")
+THRESHOLD = "100"
+
+
+class ExecEngine:
+    """One-shot binary: every request pays process start (that is the
+    engine's real cost model, so it is measured, not hidden)."""
+
+    def __init__(self, name, binary):
+        self.name = name
+        self.binary = binary
+
+    def available(self):
+        return os.path.exists(self.binary) or "run 'make' first"
+
+    def start(self):
+        pass
+
+    def stop(self):
+        pass
+
+    def request(self, in_path, out_path):
+        subprocess.run([self.binary, in_path, out_path, THRESHOLD],
+                       check=True, capture_output=True)
+
+    def batch(self, list_file, outdir):
+        subprocess.run([self.binary, "--batch", list_file, outdir, THRESHOLD],
+                       check=True, capture_output=True)
+
+
+class ServeEngine:
+    """Persistent sobel_par daemon behind its unix socket -- the warm path
+    the phase 3 gRPC servers forward to."""
+
+    name = "sobel_serve"
+
+    def __init__(self, binary):
+        self.binary = binary
+        self.proc = None
+        self.sock_path = None
+
+    def available(self):
+        return os.path.exists(self.binary) or "run 'make' first"
+
+    def start(self):
+        self.sock_path = os.path.join(tempfile.gettempdir(),
+                                      "nexus_bench_%d.sock" % os.getpid())
+        if os.path.exists(self.sock_path):
+            os.remove(self.sock_path)
+        self.proc = subprocess.Popen([self.binary, "--serve", self.sock_path],
+                                     stdout=subprocess.DEVNULL)
+        deadline = time.time() + 10
+        while not os.path.exists(self.sock_path):
+            if time.time() > deadline or self.proc.poll() is not None:
+                raise RuntimeError("--serve daemon failed to start")
+            time.sleep(0.02)
+
+    def stop(self):
+        if not self.proc:
+            return
+        try:
+            self._send("shutdown\n")
+        except OSError:
+            pass
+        self.proc.terminate()
+        self.proc.wait(timeout=5)
+        self.proc = None
+
+    def _send(self, line):
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        conn.connect(self.sock_path)
+        with conn, conn.makefile("rw") as f:
+            f.write(line)
+            f.flush()
+            return f.readline().strip()
+
+    def request(self, in_path, out_path):
+        reply = self._send("%s %s %s\n" % (in_path, out_path, THRESHOLD))
+        if not reply.startswith("OK"):
+            raise RuntimeError(reply or "daemon closed connection")
+
+    def batch(self, list_file, outdir):
+        with open(list_file) as f:
+            for line in f:
+                path = line.strip()
+                if not path:
+                    continue
+                stem = os.path.splitext(os.path.basename(path))[0]
+                self.request(path, os.path.join(outdir, stem + ".pgm"))
+
+
+class MpiEngine:
+    """mpirun sobel_mbi: single frames via the row decomposition, batches
+    via its queue mode (list file -> output dir)."""
+
+    def __init__(self, np):
+        self.np = np
+        self.name = "sobel_mbi_np%d" % np
+
+    def available(self):
+        if not shutil.which("mpirun"):
+            return "mpirun not on PATH"
+        if not os.path.exists(MBI_BIN):
+            if not shutil.which("mpicc"):
+                return "sobel_mbi not built and mpicc not on PATH"
+            subprocess.run(["mpicc", "-O3", "-std=c99", "-o", MBI_BIN,
+                            MBI_SRC, "-lm"], check=True, capture_output=True)
+        return True
+
+    def start(self):
+        pass
+
+    def stop(self):
+        pass
+
+    def _mpirun(self, *args):
+        subprocess.run(["mpirun", "-np", str(self.np), MBI_BIN] + list(args),
+                       check=True, capture_output=True)
+
+    def request(self, in_path, out_path):
+        self._mpirun(in_path, out_path, THRESHOLD)
+
+    def batch(self, list_file, outdir):
+        # queue mode dispatches whole images; needs a .txt list and >= 2 ranks
+        self._mpirun(list_file, outdir, THRESHOLD)
+
+
+class GrpcEngine:
+    """The phase 3 gRPC terminator (sobel_server.py), which forwards to the
+    native daemon. Needs grpcio installed; skipped otherwise."""
+
+    name = "grpc_server"
+    PORT = "50097"
+
+    def __init__(self):
+        self.proc = None
+
+    def available(self):
+        try:
+            import grpc  # noqa: F401
+        except ImportError:
+            return "grpcio not installed"
+        return True
+
+    def start(self):
+        server_dir = os.path.join(REPO_ROOT, "phase3", "server")
+        self.proc = subprocess.Popen([sys.executable, "sobel_server.py", self.PORT],
+                                     cwd=server_dir, stdout=subprocess.DEVNULL)
+        time.sleep(2)  # gRPC + native engine spin-up
+        if self.proc.poll() is not None:
+            raise RuntimeError("sobel_server.py exited at startup")
+
+    def stop(self):
+        if self.proc:
+            self.proc.terminate()
+            self.proc.wait(timeout=10)
+            self.proc = None
+
+    def request(self, in_path, out_path):
+        import grpc
+        sys.path.insert(0, os.path.join(REPO_ROOT, "phase3", "server"))
+        import sobel_pb2
+        import sobel_pb2_grpc
+        with grpc.insecure_channel("localhost:%s" % self.PORT) as channel:
+            stub = sobel_pb2_grpc.SobelServiceStub(channel)
+            stub.ProcessImage(sobel_pb2.SobelRequest(
+                input_path=in_path, threshold=int(THRESHOLD)))
+
+    def batch(self, list_file, outdir):
+        with open(list_file) as f:
+            for line in f:
+                path = line.strip()
+                if path:
+                    self.request(path, os.path.join(outdir, "out.pgm"))
+
+
+def log_metric(metrics_path, engine, phase, seconds, status="SUCCESS"):
+    header_needed = not os.path.exists(metrics_path)
+    with open(metrics_path, "a", newline="") as f:
+        if header_needed:
+            f.write("timestamp,latency,status,server\n")
+        f.write("%.6f,%f,%s,%s:%s\n" % (time.time(), seconds, status,
+                                        engine, phase))
+
+
+def bench_engine(engine, in_path, frames_list, outdir, reps, metrics_path):
+    engine.start()
+    try:
+        out_path = os.path.join(outdir, "single.pgm")
+
+        t0 = time.perf_counter()
+        engine.request(in_path, out_path)
+        cold = time.perf_counter() - t0
+        log_metric(metrics_path, engine.name, "cold", cold)
+
+        warm_times = []
+        for _ in range(reps):
+            t0 = time.perf_counter()
+            engine.request(in_path, out_path)
+            warm_times.append(time.perf_counter() - t0)
+            log_metric(metrics_path, engine.name, "warm", warm_times[-1])
+        warm = statistics.median(warm_times)
+
+        with open(frames_list) as f:
+            n_frames = sum(1 for line in f if line.strip())
+        t0 = time.perf_counter()
+        engine.batch(frames_list, outdir)
+        batch_s = time.perf_counter() - t0
+        log_metric(metrics_path, engine.name, "batch", batch_s)
+
+        return cold, warm, n_frames / batch_s if batch_s else 0.0, out_path
+    finally:
+        engine.stop()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("--sizes", default="512,1024,2048")
+    parser.add_argument("--frames", type=int, default=8,
+                        help="frames per batch-throughput run")
+    parser.add_argument("--reps", type=int, default=5)
+    parser.add_argument("--np", type=int, default=4, help="MPI rank count")
+    parser.add_argument("--engines", default=None,
+                        help="comma list to restrict, e.g. sobel_par,sobel_serve")
+    parser.add_argument("--out-prefix", default="engines")
+    args = parser.parse_args()
+
+    engines = [
+        ExecEngine("sobel_seq", os.path.join(BUILD, "sobel_seq")),
+        ExecEngine("sobel_par", os.path.join(BUILD, "sobel_par")),
+        ExecEngine("sobel_task", os.path.join(BUILD, "sobel_task")),
+        ServeEngine(os.path.join(BUILD, "sobel_par")),
+        MpiEngine(args.np),
+        GrpcEngine(),
+    ]
+    if args.engines:
+        wanted = set(args.engines.split(","))
+        engines = [e for e in engines if e.name in wanted]
+
+    sizes = [int(s) for s in args.sizes.split(",")]
+    summary_path = args.out_prefix + "_summary.csv"
+    metrics_path = args.out_prefix + "_metrics.csv"
+    if os.path.exists(metrics_path):
+        os.remove(metrics_path)
+
+    rows = []
+    with tempfile.TemporaryDirectory(prefix="nexus_engines_") as tmp:
+        for size in sizes:
+            in_path = os.path.join(tmp, "in_%d.pgm" % size)
+            make_synthetic_pgm(in_path, size)
+
+            # identical inputs for the batch runs: --frames copies
+            frames_list = os.path.join(tmp, "frames_%d.txt" % size)
+            with open(frames_list, "w") as f:
+                for i in range(args.frames):
+                    frame = os.path.join(tmp, "frame_%d_%d.pgm" % (size, i))
+                    if not os.path.exists(frame):
+                        shutil.copy(in_path, frame)
+                    f.write(frame + "\n")
+
+            reference = None  # phase 1 binaries must agree byte-for-byte
+            for engine in engines:
+                ok = engine.available()
+                if ok is not True:
+                    print("%-14s size=%-5d SKIPPED (%s)" % (engine.name, size, ok))
+                    continue
+                outdir = os.path.join(tmp, "out_%s_%d" % (engine.name, size))
+                os.makedirs(outdir, exist_ok=True)
+                try:
+                    cold, warm, batch_ips, out_path = bench_engine(
+                        engine, in_path, frames_list, outdir, args.reps,
+                        metrics_path)
+                except Exception as exc:
+                    print("%-14s size=%-5d FAILED (%s)" % (engine.name, size, exc))
+                    log_metric(metrics_path, engine.name, "warm", 0.0, "FAILED")
+                    continue
+
+                if isinstance(engine, (ExecEngine, ServeEngine)) and \
+                        os.path.exists(out_path):
+                    with open(out_path, "rb") as f:
+                        data = f.read()
+                    if reference is None:
+                        reference = data
+                    elif data != reference:
+                        print("WARNING: %s output differs from the other "
+                              "phase 1 engines at size %d" % (engine.name, size))
+
+                rows.append({
+                    "engine": engine.name,
+                    "size": size,
+                    "frames": args.frames,
+                    "cold_s": "%.6f" % cold,
+                    "warm_s": "%.6f" % warm,
+                    "batch_images_s": "%.2f" % batch_ips,
+                })
+                print("%-14s size=%-5d cold=%.6fs warm=%.6fs batch=%.1f img/s" %
+                      (engine.name, size, cold, warm, batch_ips))
+
+    if not rows:
+        sys.exit("no engine produced results")
+    with open(summary_path, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+        writer.writeheader()
+        writer.writerows(rows)
+    print("\nWrote %s (%d rows) and %s" % (summary_path, len(rows), metrics_path))
+
+
+if __name__ == "__main__":
+    main()
@@ -2,6 +2,7 @@ from concurrent import futures
 import grpc
 import sobel_pb2
 import sobel_pb2_grpc
+import socket
 import subprocess
 import time
 import os
@@ -11,11 +12,63 @@ import sys
 BASE_DIR = os.path.dirname(os.path.abspath(__file__))
 SOBEL_EXEC = os.path.abspath(os.path.join(BASE_DIR, "../../phase2/src/sobel_mbi"))
 
+# Native engine: a persistent sobel_par daemon owns the hot path (warm
+# thread pool, pre-allocated per-worker buffers), and this process only
+# terminates gRPC and forwards one request line per RPC over its unix
+# socket. The proto exchanges paths, not pixels, so no pixel buffer ever
+# enters the interpreter. Falls back to spawning mpirun per request if
+# the binary has not been built.
+ENGINE_EXEC = os.path.abspath(os.path.join(BASE_DIR, "../../build/sobel_par"))
+
 LOG_DIR = os.path.abspath(os.path.join(BASE_DIR, "../logs"))
 os.makedirs(LOG_DIR, exist_ok=True)
 
+
+class NativeEngine:
+    """Lifecycle and line protocol for the C daemon (one per replica)."""
+
+    def __init__(self, port):
+        self.socket_path = f"/tmp/nexus_sobel_{port}.sock"
+        self.proc = subprocess.Popen(
+            [ENGINE_EXEC, "--serve", self.socket_path],
+            stdout=subprocess.DEVNULL,
+        )
+        deadline = time.time() + 10
+        while not os.path.exists(self.socket_path):
+            if time.time() > deadline or self.proc.poll() is not None:
+                raise RuntimeError("native engine failed to start")
+            time.sleep(0.05)
+        print(f"Native engine ready on {self.socket_path}")
+
+    def process(self, input_path, output_path, threshold):
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        conn.connect(self.socket_path)
+        with conn, conn.makefile("rw") as f:
+            f.write(f"{input_path} {output_path} {threshold}\n")
+            f.flush()
+            reply = f.readline().strip()
+        if not reply.startswith("OK"):
+            raise RuntimeError(reply or "engine closed connection")
+
+    def shutdown(self):
+        try:
+            conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            conn.connect(self.socket_path)
+            with conn, conn.makefile("rw") as f:
+                f.write("shutdown\n")
+                f.flush()
+                f.readline()
+        except Exception:
+            pass
+        self.proc.terminate()
+        self.proc.wait(timeout=5)
+
+
 class SobelService(sobel_pb2_grpc.SobelServiceServicer):
 
+    def __init__(self, engine):
+        self.engine = engine
+
     def ProcessImage(self, request, context):
         input_path = request.input_path
         threshold = request.threshold if request.threshold else 100
@@ -25,11 +78,14 @@ class SobelService(sobel_pb2_grpc.SobelServiceServicer):
         print(f"[REQUEST] {input_path}, threshold={threshold}")
 
         try:
-            subprocess.run(
-                ["mpirun", "-np", "4", SOBEL_EXEC, input_path, output_path, str(threshold)],
-                check=True
-            )
-        except subprocess.CalledProcessError as e:
+            if self.engine is not None:
+                self.engine.process(input_path, output_path, threshold)
+            else:
+                subprocess.run(
+                    ["mpirun", "-np", "4", SOBEL_EXEC, input_path, output_path, str(threshold)],
+                    check=True
+                )
+        except Exception as e:
             context.set_details(str(e))
             context.set_code(grpc.StatusCode.INTERNAL)
             return sobel_pb2.SobelResponse()
@@ -43,9 +99,15 @@ class SobelService(sobel_pb2_grpc.SobelServiceServicer):
             end_time=int(end_time * 1000)
         )
 def serve(port):
+    engine = None
+    if os.path.exists(ENGINE_EXEC):
+        engine = NativeEngine(port)
+    else:
+        print(f"WARNING: {ENGINE_EXEC} not built; falling back to mpirun per request")
+
     server = grpc.server(futures.ThreadPoolExecutor(max_workers=4))
-    sobel_pb2_grpc.add_SobelServiceServicer_to_server(SobelService(), server)
-    
+    sobel_pb2_grpc.add_SobelServiceServicer_to_server(SobelService(engine), server)
+
     server.add_insecure_port(f"[::]:{port}")
     server.start()
     print(f"gRPC Sobel server running on port {port}...")
@@ -55,8 +117,10 @@ def serve(port):
     except KeyboardInterrupt:
         print("\nShutting down server gracefully...")
         server.stop(0)
+        if engine is not None:
+            engine.shutdown()
         print("Server stopped.")
 
 if __name__ == "__main__":
     port = sys.argv[1] if len(sys.argv) > 1 else "50051"
-    serve(port)
\ No newline at end of file
+    serve(port)
@@ -0,0 +1,578 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define MAX_PATH 256
+// pic structure
+typedef struct
+{
+    int width;
+    int height;
+    int max_val;
+    unsigned char *data;
+    void *map_base;  /* non-NULL when data points into an mmap'd PGM file */
+    size_t map_len;
+} Image;
+
+static Image *create_image(int width, int height, int max_val)
+{
+    Image *img = (Image *)malloc(sizeof(Image));
+    if (!img)
+        return NULL;
+    img->width = width;
+    img->height = height;
+    img->max_val = max_val;
+    img->map_base = NULL;
+    img->map_len = 0;
+    img->data = (unsigned char *)malloc((size_t)width * (size_t)height);
+    if (!img->data)
+    {
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+static void free_image(Image *img)
+{
+    if (!img)
+        return;
+    if (img->map_base)
+        munmap(img->map_base, img->map_len);
+    else
+        free(img->data);
+    free(img);
+}
+
+/*
+Native P5/PGM fast path: mmap() the file and point Image.data straight at
+the mapped pixel bytes -- no decode, no copy, no pixel allocation. Most
+pipeline inputs are 8-bit PGM produced upstream by convert_to_pgm.py, so
+this skips stb entirely for them; anything else (JPEG/PNG/...) still goes
+through stbi_load() below.
+*/
+static Image *load_pgm_mmap(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 10)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file open */
+    if (base == MAP_FAILED)
+        return NULL;
+
+    const char *p = (const char *)base;
+    const char *end = p + st.st_size;
+
+    if (p[0] != 'P' || p[1] != '5')
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    p += 2;
+
+    /* Parse width, height, maxval; whitespace and # comments may separate them */
+    int fields[3];
+    for (int i = 0; i < 3; i++)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '#'))
+        {
+            if (*p == '#')
+                while (p < end && *p != '\n')
+                    p++;
+            else
+                p++;
+        }
+        int value = 0;
+        if (p >= end || *p < '0' || *p > '9')
+        {
+            munmap(base, (size_t)st.st_size);
+            return NULL;
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+        fields[i] = value;
+    }
+    p++; /* exactly one whitespace byte separates maxval from pixel data */
+
+    int width = fields[0], height = fields[1], max_val = fields[2];
+    if (width <= 0 || height <= 0 || max_val <= 0 || max_val > 255 ||
+        end - p < (long)((size_t)width * height))
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    Image *img = (Image *)malloc(sizeof(Image));
+    if (!img)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    img->width = width;
+    img->height = height;
+    img->max_val = max_val;
+    img->map_base = base;
+    img->map_len = (size_t)st.st_size;
+    img->data = (unsigned char *)p; /* zero-copy: points into the mapping */
+    return img;
+}
+
+// loading image using stb_image as 1-channel grayscale
+static Image *load_image(const char *filename)
+{
+    /* 8-bit PGM inputs map straight from disk; everything else decodes via stb */
+    Image *mapped = load_pgm_mmap(filename);
+    if (mapped)
+        return mapped;
+
+    int width, height, channels;
+    unsigned char *data = stbi_load(filename, &width, &height, &channels, 1); // Force 1 channel (grayscale)
+
+    if (!data)
+    {
+        fprintf(stderr, "Error: stb_image failed to load %s: %s\n", filename, stbi_failure_reason());
+        return NULL;
+    }
+
+    Image *img = create_image(width, height, 255);
+    if (!img)
+    {
+        stbi_image_free(data);
+        return NULL;
+    }
+
+    // Copy grayscale data
+    memcpy(img->data, data, width * height);
+    stbi_image_free(data);
+
+    return img;
+}
+
+static int save_pgm(const char *filename, Image *img)
+{
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Error: Cannot create file %s\n", filename);
+        return -1;
+    }
+
+    fprintf(file, "P5\n%d %d\n%d\n", img->width, img->height, img->max_val);
+    fwrite(img->data, sizeof(unsigned char), img->width * img->height, file);
+
+    fclose(file);
+    return 0;
+}
+
+/*
+Phase-level instrumentation. Every binary reports the same four phases
+(decode, sobel, threshold, encode) as wall-clock seconds plus effective
+MPix/s, and --csv=<file> appends one row per phase in the schema that
+phase3/metrics.csv and phase3/performance/run_analysis.py already use
+(timestamp,latency,status,server), with server = "<binary>:<phase>".
+For Canny the "sobel" slot is the fused blur/gradient/NMS band phase and
+the "threshold" slot is hysteresis.
+*/
+static const char *metrics_csv_path = NULL;
+
+static double now_seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void metrics_log_phase(const char *binary, const char *phase, double seconds)
+{
+    if (!metrics_csv_path)
+        return;
+    FILE *file = fopen(metrics_csv_path, "a");
+    if (!file)
+        return;
+    if (ftell(file) == 0)
+        fprintf(file, "timestamp,latency,status,server\n");
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fprintf(file, "%.6f,%f,SUCCESS,%s:%s\n",
+            ts.tv_sec + ts.tv_nsec * 1e-9, seconds, binary, phase);
+    fclose(file);
+}
+
+static void report_phases(const char *binary, int width, int height,
+                          double decode_s, double sobel_s, double threshold_s,
+                          double encode_s)
+{
+    double mpix = (double)width * height / 1e6;
+    double total = decode_s + sobel_s + threshold_s + encode_s;
+    printf("Phase timings: decode=%.6f sobel=%.6f threshold=%.6f encode=%.6f total=%.6f s\n",
+           decode_s, sobel_s, threshold_s, encode_s, total);
+    printf("Processed %.2f MPix (%zu bytes) at %.1f MPix/s (sobel phase), %.1f MPix/s end-to-end\n",
+           mpix, (size_t)width * height,
+           sobel_s > 0 ? mpix / sobel_s : 0.0, total > 0 ? mpix / total : 0.0);
+    metrics_log_phase(binary, "decode", decode_s);
+    metrics_log_phase(binary, "sobel", sobel_s);
+    metrics_log_phase(binary, "threshold", threshold_s);
+    metrics_log_phase(binary, "encode", encode_s);
+    metrics_log_phase(binary, "total", total);
+}
+
+/*
+Canny as a fused band engine. The blur, gradient and non-maximum
+suppression stages all have small fixed stencils (radius 2, 1, 1), so
+instead of three full-frame passes -- each streaming the whole image
+through the cache -- every thread takes a band of BAND_ROWS rows and
+runs all three stages over it while the band (a few hundred KB of
+scratch) is cache-resident. Bands overlap by the accumulated stencil
+halo (4 rows), recomputing a little at the seams to stay independent;
+that is far cheaper than the DRAM traffic of separate passes. The row
+partitioning mirrors the schedule used by src/parallel.c.
+
+Only hysteresis is global: a serial flood fill from strong pixels that
+promotes 8-connected weak pixels. It touches only the sparse edge set,
+so it stays a small fraction of the fused phase.
+*/
+
+#define BAND_ROWS 64
+#define WEAK 128
+#define STRONG 255
+
+/* 5x5 binomial approximation of a Gaussian; 16 * 16 = 256 -> shift 8 */
+static const int gauss5[5] = {1, 4, 6, 4, 1};
+
+/* Direction quantization thresholds: tan(22.5) and tan(67.5) in 12-bit
+   fixed point, so the sector test needs no atan2 or floats */
+#define TAN22_FX 1697  /* tan(22.5 deg) * 4096 */
+#define TAN67_FX 9890  /* tan(67.5 deg) * 4096 */
+
+/*
+Fused blur + gradient + NMS + classification for rows [y0, y1). Writes
+0 / WEAK / STRONG into edges. Frame-border pixels are classified 0 (the
+NMS neighborhood is undefined there), which is also what OpenCV does.
+*/
+static void canny_band(const Image *input, unsigned char *edges,
+                       int y0, int y1, int low, int high)
+{
+    int width = input->width, height = input->height;
+
+    /* Rows of blurred data this band needs: NMS rows [y0, y1) ->
+       gradient rows [y0-1, y1+1) -> blurred rows [y0-2, y1+2) */
+    int b0 = y0 - 2;
+    if (b0 < 0)
+        b0 = 0;
+    int b1 = y1 + 2;
+    if (b1 > height)
+        b1 = height;
+    int g0 = y0 - 1;
+    if (g0 < 0)
+        g0 = 0;
+    int g1 = y1 + 1;
+    if (g1 > height)
+        g1 = height;
+    int brows = b1 - b0, grows = g1 - g0;
+
+    unsigned char *blur = (unsigned char *)malloc((size_t)brows * width);
+    int *vpass = (int *)malloc((size_t)width * sizeof(int));
+    int *gx = (int *)malloc((size_t)grows * width * sizeof(int));
+    int *gy = (int *)malloc((size_t)grows * width * sizeof(int));
+    int *mag = (int *)malloc((size_t)grows * width * sizeof(int));
+    if (!blur || !vpass || !gx || !gy || !mag)
+    {
+        /* Degrade to no edges in this band rather than leaving its rows
+           of the shared edge map uninitialized for hysteresis to read */
+        fprintf(stderr, "Error: Out of memory in canny_band\n");
+        memset(edges + (size_t)y0 * width, 0, (size_t)(y1 - y0) * width);
+        goto out;
+    }
+
+    /* Stage 1: separable 5x5 Gaussian into the band-local blur buffer */
+    for (int b = b0; b < b1; b++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            int acc = 0;
+            for (int t = 0; t < 5; t++)
+            {
+                int yy = b + t - 2;
+                if (yy < 0)
+                    yy = 0;
+                if (yy > height - 1)
+                    yy = height - 1;
+                acc += gauss5[t] * input->data[(size_t)yy * width + x];
+            }
+            vpass[x] = acc;
+        }
+        unsigned char *blur_row = blur + (size_t)(b - b0) * width;
+        for (int x = 0; x < width; x++)
+        {
+            int acc = 0;
+            for (int t = 0; t < 5; t++)
+            {
+                int xx = x + t - 2;
+                if (xx < 0)
+                    xx = 0;
+                if (xx > width - 1)
+                    xx = width - 1;
+                acc += gauss5[t] * vpass[xx];
+            }
+            blur_row[x] = (unsigned char)(acc >> 8);
+        }
+    }
+
+    /* Stage 2: Sobel gradient over the blurred band, while it is hot */
+    for (int g = g0; g < g1; g++)
+    {
+        const unsigned char *row_m1 = blur + (size_t)(((g == 0) ? 0 : g - 1) - b0) * width;
+        const unsigned char *row_0 = blur + (size_t)(g - b0) * width;
+        const unsigned char *row_p1 = blur + (size_t)(((g == height - 1) ? g : g + 1) - b0) * width;
+        int *gx_row = gx + (size_t)(g - g0) * width;
+        int *gy_row = gy + (size_t)(g - g0) * width;
+        int *mag_row = mag + (size_t)(g - g0) * width;
+        for (int x = 0; x < width; x++)
+        {
+            int xm1 = (x == 0) ? 0 : x - 1;
+            int xp1 = (x == width - 1) ? width - 1 : x + 1;
+            int sgx = -row_m1[xm1] + row_m1[xp1]
+                      - 2 * row_0[xm1] + 2 * row_0[xp1]
+                      - row_p1[xm1] + row_p1[xp1];
+            int sgy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                      + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+            gx_row[x] = sgx;
+            gy_row[x] = sgy;
+            mag_row[x] = (int)sqrt((double)(sgx * sgx + sgy * sgy));
+        }
+    }
+
+    /* Stage 3: NMS + double threshold, straight into the shared edge map */
+    for (int y = y0; y < y1; y++)
+    {
+        unsigned char *edge_row = edges + (size_t)y * width;
+        if (y == 0 || y == height - 1)
+        {
+            memset(edge_row, 0, width);
+            continue;
+        }
+        const int *mag_m1 = mag + (size_t)(y - 1 - g0) * width;
+        const int *mag_0 = mag + (size_t)(y - g0) * width;
+        const int *mag_p1 = mag + (size_t)(y + 1 - g0) * width;
+        const int *gx_row = gx + (size_t)(y - g0) * width;
+        const int *gy_row = gy + (size_t)(y - g0) * width;
+
+        edge_row[0] = edge_row[width - 1] = 0;
+        for (int x = 1; x < width - 1; x++)
+        {
+            int m = mag_0[x];
+            if (m < low)
+            {
+                edge_row[x] = 0;
+                continue;
+            }
+            int ax = abs(gx_row[x]), ay = abs(gy_row[x]);
+            int n1, n2;
+            if (ay * 4096 <= ax * TAN22_FX)
+            {
+                /* gradient ~horizontal: suppress against left/right */
+                n1 = mag_0[x - 1];
+                n2 = mag_0[x + 1];
+            }
+            else if (ay * 4096 >= ax * TAN67_FX)
+            {
+                /* gradient ~vertical: suppress against up/down */
+                n1 = mag_m1[x];
+                n2 = mag_p1[x];
+            }
+            else if ((gx_row[x] > 0) == (gy_row[x] > 0))
+            {
+                /* 45 deg diagonal */
+                n1 = mag_m1[x - 1];
+                n2 = mag_p1[x + 1];
+            }
+            else
+            {
+                /* 135 deg diagonal */
+                n1 = mag_m1[x + 1];
+                n2 = mag_p1[x - 1];
+            }
+            if (m >= n1 && m >= n2)
+                edge_row[x] = (m >= high) ? STRONG : WEAK;
+            else
+                edge_row[x] = 0;
+        }
+    }
+
+out:
+    free(blur);
+    free(vpass);
+    free(gx);
+    free(gy);
+    free(mag);
+}
+
+/*
+Hysteresis: flood fill from every strong pixel, promoting 8-connected
+weak pixels to strong; whatever stays weak is cleared. Serial, explicit
+stack -- the fill only walks the edge set, not the frame.
+*/
+static void hysteresis(unsigned char *edges, int width, int height)
+{
+    size_t n = (size_t)width * height;
+    int *stack = (int *)malloc(n * sizeof(int));
+    if (!stack)
+    {
+        /* Degrade to strong-only edges rather than failing the frame */
+        for (size_t i = 0; i < n; i++)
+            if (edges[i] == WEAK)
+                edges[i] = 0;
+        return;
+    }
+    long top = 0;
+
+    for (size_t i = 0; i < n; i++)
+        if (edges[i] == STRONG)
+            stack[top++] = (int)i;
+
+    while (top > 0)
+    {
+        int idx = stack[--top];
+        int y = idx / width, x = idx % width;
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int ny = y + dy, nx = x + dx;
+                if (ny < 0 || ny >= height || nx < 0 || nx >= width)
+                    continue;
+                int nidx = ny * width + nx;
+                if (edges[nidx] == WEAK)
+                {
+                    edges[nidx] = STRONG;
+                    stack[top++] = nidx;
+                }
+            }
+        }
+    }
+    free(stack);
+
+    for (size_t i = 0; i < n; i++)
+        if (edges[i] == WEAK)
+            edges[i] = 0;
+}
+
+static void canny(const Image *input, Image *out, int low, int high,
+                  double *fused_s, double *hyst_s)
+{
+    int height = input->height;
+    int bands = (height + BAND_ROWS - 1) / BAND_ROWS;
+
+    double t0 = now_seconds();
+    #pragma omp parallel for schedule(static)
+    for (int band = 0; band < bands; band++)
+    {
+        int y0 = band * BAND_ROWS;
+        int y1 = y0 + BAND_ROWS;
+        if (y1 > height)
+            y1 = height;
+        canny_band(input, out->data, y0, y1, low, high);
+    }
+    *fused_s = now_seconds() - t0;
+
+    t0 = now_seconds();
+    hysteresis(out->data, input->width, input->height);
+    *hyst_s = now_seconds() - t0;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Strip option flags before positional argument handling */
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--csv=", 6) == 0)
+        {
+            metrics_csv_path = argv[i] + 6;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+    }
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <input_image> <output_image.pgm> [low] [high]\n", argv[0]);
+        fprintf(stderr, "  low:  Weak-edge threshold (default: 50)\n");
+        fprintf(stderr, "  high: Strong-edge threshold (default: 100)\n");
+        fprintf(stderr, "  --csv=FILE: Append per-phase timings in the phase3 metrics.csv schema\n");
+        return 1;
+    }
+
+    int low = 50, high = 100;
+    if (argc >= 4)
+        low = atoi(argv[3]);
+    if (argc >= 5)
+        high = atoi(argv[4]);
+    if (low < 0)
+        low = 0;
+    if (high < low)
+        high = low;
+
+    printf("Loading image: %s\n", argv[1]);
+    double t0 = now_seconds();
+    Image *input = load_image(argv[1]);
+    double decode_s = now_seconds() - t0;
+    if (!input)
+    {
+        return 1;
+    }
+    printf("Image loaded: %dx%d\n", input->width, input->height);
+
+    Image *out = create_image(input->width, input->height, 255);
+    if (!out)
+    {
+        free_image(input);
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+
+    double fused_s = 0.0, hyst_s = 0.0;
+    canny(input, out, low, high, &fused_s, &hyst_s);
+    printf("canny runtime: %.6f seconds (fused bands %.6f, hysteresis %.6f)\n",
+           fused_s + hyst_s, fused_s, hyst_s);
+
+    printf("Saving output image: %s\n", argv[2]);
+    t0 = now_seconds();
+    int save_rc = save_pgm(argv[2], out);
+    double encode_s = now_seconds() - t0;
+    if (save_rc != 0)
+    {
+        free_image(out);
+        free_image(input);
+        return 1;
+    }
+
+    report_phases("canny", input->width, input->height,
+                  decode_s, fused_s, hyst_s, encode_s);
+
+    free_image(out);
+    free_image(input);
+    printf("Done.\n");
+    return 0;
+}
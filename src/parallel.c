@@ -1,10 +1,21 @@
+#define _GNU_SOURCE /* O_DIRECT */
+
 #include <omp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
-
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -17,8 +28,102 @@ typedef struct
     int height;
     int max_val;
     unsigned char *data;
+    void *map_base;  /* non-NULL when data points into an mmap'd PGM file */
+    size_t map_len;
 } Image;
 
+
+/*
+Arena allocator: steady-state batch and server workloads allocate and
+free the same two or three multi-megabyte frame buffers over and over,
+which hammers the allocator and bounces pages back to the kernel between
+frames. image_arena_init() reserves one large anonymous mapping up front
+(hinted to use huge pages) and create_image() recycles fixed blocks out
+of it, so after the first frame there are zero mallocs and zero new page
+faults. Anything that does not fit falls back to plain malloc.
+*/
+
+#define ARENA_MAX_BLOCKS 16
+
+typedef struct
+{
+    unsigned char *ptr;
+    size_t size;
+    int in_use;
+} ArenaBlock;
+
+static unsigned char *arena_base = NULL;
+static size_t arena_size = 0;
+static size_t arena_used = 0;
+static ArenaBlock arena_blocks[ARENA_MAX_BLOCKS];
+static int arena_block_count = 0;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int image_arena_init(size_t bytes)
+{
+    void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return -1;
+#ifdef MADV_HUGEPAGE
+    madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+    arena_base = (unsigned char *)base;
+    arena_size = bytes;
+    arena_used = 0;
+    arena_block_count = 0;
+    return 0;
+}
+
+static unsigned char *arena_alloc(size_t size)
+{
+    if (!arena_base)
+        return NULL;
+    size = (size + 63) & ~(size_t)63; /* keep blocks cacheline aligned */
+
+    unsigned char *result = NULL;
+    pthread_mutex_lock(&arena_lock);
+    /* Recycle a free block of the same size first (the steady-state hit) */
+    for (int i = 0; i < arena_block_count; i++)
+    {
+        if (!arena_blocks[i].in_use && arena_blocks[i].size == size)
+        {
+            arena_blocks[i].in_use = 1;
+            result = arena_blocks[i].ptr;
+            break;
+        }
+    }
+    if (!result && arena_block_count < ARENA_MAX_BLOCKS && arena_used + size <= arena_size)
+    {
+        ArenaBlock *block = &arena_blocks[arena_block_count++];
+        block->ptr = arena_base + arena_used;
+        block->size = size;
+        block->in_use = 1;
+        arena_used += size;
+        result = block->ptr;
+    }
+    pthread_mutex_unlock(&arena_lock);
+    return result;
+}
+
+/* Returns 1 if ptr belonged to the arena (and is now recycled), 0 otherwise */
+static int arena_release(unsigned char *ptr)
+{
+    if (!arena_base || ptr < arena_base || ptr >= arena_base + arena_size)
+        return 0;
+    pthread_mutex_lock(&arena_lock);
+    for (int i = 0; i < arena_block_count; i++)
+    {
+        if (arena_blocks[i].ptr == ptr)
+        {
+            arena_blocks[i].in_use = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&arena_lock);
+    return 1;
+}
+
 static Image *create_image(int width, int height, int max_val)
 {
     Image *img = (Image *)malloc(sizeof(Image));
@@ -27,7 +132,11 @@ static Image *create_image(int width, int height, int max_val)
     img->width = width;
     img->height = height;
     img->max_val = max_val;
-    img->data = (unsigned char *)malloc((size_t)width * (size_t)height);
+    img->map_base = NULL;
+    img->map_len = 0;
+    img->data = arena_alloc((size_t)width * (size_t)height);
+    if (!img->data)
+        img->data = (unsigned char *)malloc((size_t)width * (size_t)height);
     if (!img->data)
     {
         free(img);
@@ -40,13 +149,149 @@ static void free_image(Image *img)
 {
     if (!img)
         return;
-    free(img->data);
+    if (img->map_base)
+        munmap(img->map_base, img->map_len);
+    else if (!arena_release(img->data))
+        free(img->data);
     free(img);
 }
 
+
+/*
+Native P5/PGM fast path: mmap() the file and point Image.data straight at
+the mapped pixel bytes -- no decode, no copy, no pixel allocation. Most
+pipeline inputs are 8-bit PGM produced upstream by convert_to_pgm.py, so
+this skips stb entirely for them; anything else (JPEG/PNG/...) still goes
+through stbi_load() below.
+*/
+static Image *load_pgm_mmap(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 10)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file open */
+    if (base == MAP_FAILED)
+        return NULL;
+
+    const char *p = (const char *)base;
+    const char *end = p + st.st_size;
+
+    if (p[0] != 'P' || p[1] != '5')
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    p += 2;
+
+    /* Parse width, height, maxval; whitespace and # comments may separate them */
+    int fields[3];
+    for (int i = 0; i < 3; i++)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '#'))
+        {
+            if (*p == '#')
+                while (p < end && *p != '\n')
+                    p++;
+            else
+                p++;
+        }
+        int value = 0;
+        if (p >= end || *p < '0' || *p > '9')
+        {
+            munmap(base, (size_t)st.st_size);
+            return NULL;
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+        fields[i] = value;
+    }
+    p++; /* exactly one whitespace byte separates maxval from pixel data */
+
+    int width = fields[0], height = fields[1], max_val = fields[2];
+    if (width <= 0 || height <= 0 || max_val <= 0 || max_val > 255 ||
+        end - p < (long)((size_t)width * height))
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    Image *img = (Image *)malloc(sizeof(Image));
+    if (!img)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    img->width = width;
+    img->height = height;
+    img->max_val = max_val;
+    img->map_base = base;
+    img->map_len = (size_t)st.st_size;
+    img->data = (unsigned char *)p; /* zero-copy: points into the mapping */
+    return img;
+}
+
+
+/*
+NUMA mode (--numa): on multi-socket nodes the whole frame otherwise lands
+on whichever node first touches it (the load_image copy), and half the
+kernel's reads then cross the interconnect. In this mode:
+  - OMP_PROC_BIND/OMP_PLACES are set (if unset) before the runtime starts,
+    so threads stay pinned to cores for the life of the process;
+  - input and output buffers are first-touched row-by-row with the same
+    schedule(static) partition the kernel uses, so each thread's rows are
+    resident on its own socket -- including the output pages, which makes
+    the single out buffer effectively per-socket;
+  - mmap'd PGM inputs are copied out of the page cache with the same
+    partition, trading one copy for local reads in the kernel.
+*/
+static bool numa_mode = false;
+
+static void copy_rows_first_touch(unsigned char *dst, const unsigned char *src,
+                                  int width, int height)
+{
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++)
+        memcpy(dst + (size_t)y * width, src + (size_t)y * width, width);
+}
+
+static void first_touch_rows(unsigned char *data, int width, int height)
+{
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++)
+        memset(data + (size_t)y * width, 0, width);
+}
+
 // loading image using stb_image as 1-channel grayscale
 static Image *load_image(const char *filename)
 {
+    /* 8-bit PGM inputs map straight from disk; everything else decodes via stb */
+    Image *mapped = load_pgm_mmap(filename);
+    if (mapped)
+    {
+        if (!numa_mode)
+            return mapped;
+        /* Page-cache pages have no useful placement; copy row blocks onto
+           the sockets that will read them */
+        Image *img = create_image(mapped->width, mapped->height, mapped->max_val);
+        if (!img)
+        {
+            free_image(mapped);
+            return NULL;
+        }
+        copy_rows_first_touch(img->data, mapped->data, img->width, img->height);
+        free_image(mapped);
+        return img;
+    }
+
     int width, height, channels;
     unsigned char *data = stbi_load(filename, &width, &height, &channels, 1); // Force 1 channel (grayscale)
 
@@ -64,14 +309,81 @@ static Image *load_image(const char *filename)
     }
 
     // Copy grayscale data
-    memcpy(img->data, data, width * height);
+    if (numa_mode)
+        copy_rows_first_touch(img->data, data, width, height);
+    else
+        memcpy(img->data, data, width * height);
     stbi_image_free(data);
 
     return img;
 }
 
+/*
+Output write policy. --fdatasync makes each frame durable before the
+writer thread moves on; --odirect bypasses the page cache, which avoids
+evicting the input working set when dumping large batches to slow
+storage. O_DIRECT needs block-aligned buffers and sizes, so it stages
+through one aligned bounce buffer and trims the padding with ftruncate;
+filesystems that reject O_DIRECT (tmpfs) fall back to the buffered path.
+*/
+static bool write_odirect = false;
+static bool write_fdatasync = false;
+
+static int save_pgm_direct(const char *filename, Image *img)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0)
+        return 1; /* caller falls back to the buffered path */
+
+    char header[64];
+    int hlen = snprintf(header, sizeof(header), "P5\n%d %d\n%d\n",
+                        img->width, img->height, img->max_val);
+    size_t total = (size_t)hlen + (size_t)img->width * img->height;
+    size_t padded = (total + 4095) & ~(size_t)4095;
+
+    unsigned char *buf = NULL;
+    if (posix_memalign((void **)&buf, 4096, padded) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    memcpy(buf, header, hlen);
+    memcpy(buf + hlen, img->data, (size_t)img->width * img->height);
+    memset(buf + total, 0, padded - total);
+
+    int rc = 0;
+    size_t written = 0;
+    while (written < padded)
+    {
+        ssize_t n = write(fd, buf + written, padded - written);
+        if (n <= 0)
+        {
+            rc = -1;
+            break;
+        }
+        written += (size_t)n;
+    }
+    if (rc == 0 && ftruncate(fd, (off_t)total) != 0)
+        rc = -1;
+    if (rc == 0 && write_fdatasync)
+        fdatasync(fd);
+    close(fd);
+    free(buf);
+    if (rc != 0)
+        fprintf(stderr, "Error: O_DIRECT write failed for %s\n", filename);
+    return rc;
+}
+
 static int save_pgm(const char *filename, Image *img)
 {
+    if (write_odirect)
+    {
+        int rc = save_pgm_direct(filename, img);
+        if (rc <= 0)
+            return rc;
+        /* rc > 0: filesystem rejected O_DIRECT; use the buffered path */
+    }
+
     FILE *file = fopen(filename, "wb");
     if (!file)
     {
@@ -82,92 +394,1359 @@ static int save_pgm(const char *filename, Image *img)
     fprintf(file, "P5\n%d %d\n%d\n", img->width, img->height, img->max_val);
     fwrite(img->data, sizeof(unsigned char), img->width * img->height, file);
 
+    if (write_fdatasync)
+    {
+        fflush(file);
+        fdatasync(fileno(file));
+    }
     fclose(file);
     return 0;
 }
 
 /*
-If (x,y) is outside image boundaries, it clamps to the closest border coordinate. This is a common way to handle boundaries for convolution (avoids special casing edges).
+What are gx and gy?
+- gx is the discrete approximation of the derivative in the x (horizontal) direction.
+- gy is the derivative in the y (vertical) direction.
+They are computed by convolving the 3×3 neighborhood with the Sobel kernels.
+*/
+
+/*
+Magnitude mode: exact is sqrt(gx^2 + gy^2); approx is |gx| + |gy|, which
+keeps the kernel in pure integer math. For consumers that threshold the
+result into a binary edge map the approx mode is a drop-in replacement
+(edges shift by at most the estimator error of ~1.4x on diagonals).
 */
+typedef enum
+{
+    MAG_EXACT = 0,
+    MAG_APPROX = 1
+} MagMode;
 
-static unsigned char get_pixel(const Image *img, int x, int y)
+static MagMode mag_mode = MAG_EXACT;
+
+/*
+Scalar Sobel over columns [x0, x1) of one row. The three row pointers are
+already clamped in y by the caller; only x needs clamping here, which the
+caller restricts to the first/last column and the SIMD tail.
+*/
+static void sobel_row_scalar(const unsigned char *row_m1, const unsigned char *row_0,
+                             const unsigned char *row_p1, unsigned char *dst_row,
+                             int width, int x0, int x1)
 {
-    if (x < 0)
-        x = 0;
-    if (x >= img->width)
-        x = img->width - 1;
-    if (y < 0)
-        y = 0;
-    if (y >= img->height)
-        y = img->height - 1;
+    for (int x = x0; x < x1; x++)
+    {
+        int xm1 = (x == 0) ? 0 : x - 1;
+        int xp1 = (x == width - 1) ? width - 1 : x + 1;
 
-    return img->data[y * img->width + x];
+        int gx = -row_m1[xm1] + row_m1[xp1]
+                 - 2 * row_0[xm1] + 2 * row_0[xp1]
+                 - row_p1[xm1] + row_p1[xp1];
+        int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                 + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+
+        int mag;
+        if (mag_mode == MAG_APPROX)
+            mag = abs(gx) + abs(gy);
+        else
+            mag = (int)sqrt((double)(gx * gx + gy * gy));
+        if (mag > 255)
+            mag = 255;
+        if (mag < 0)
+            mag = 0;
+        dst_row[x] = (unsigned char)mag;
+    }
 }
 
-static void set_pixel(Image *img, int x, int y, unsigned char value)
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/*
+SIMD Sobel for one row: processes interior columns 8 at a time with SSE2
+(present on every x86-64; -march=native in the Makefile picks the widest
+encoding available). gx/gy fit in 16-bit lanes (|g| <= 1020), the squared
+sums need 32-bit, and the sqrt runs on 4 floats at a time. The final
+packs/packus pair saturates the magnitude into 0..255 for free. Only the
+first/last column and the <8-pixel tail fall back to the scalar path.
+*/
+static void sobel_row_simd(const unsigned char *row_m1, const unsigned char *row_0,
+                           const unsigned char *row_p1, unsigned char *dst_row,
+                           int width)
 {
-    if (x >= 0 && x < img->width && y >= 0 && y < img->height)
+    if (width < 2)
+    {
+        sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, 0, width);
+        return;
+    }
+
+    /* Borders: x clamps only at the first and last column */
+    sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, 0, 1);
+    sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, width - 1, width);
+
+    const __m128i zero = _mm_setzero_si128();
+    int x = 1;
+    for (; x + 8 <= width - 1; x += 8)
     {
-        img->data[y * img->width + x] = value;
+        /* Load the 3x3 neighborhood as 8 widened 16-bit pixels per tap */
+        __m128i p00 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x - 1)), zero);
+        __m128i p01 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x)), zero);
+        __m128i p02 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x + 1)), zero);
+        __m128i p10 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_0 + x - 1)), zero);
+        __m128i p12 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_0 + x + 1)), zero);
+        __m128i p20 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x - 1)), zero);
+        __m128i p21 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x)), zero);
+        __m128i p22 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x + 1)), zero);
+
+        /* gx = (p02 - p00) + 2*(p12 - p10) + (p22 - p20) */
+        __m128i gx = _mm_add_epi16(_mm_sub_epi16(p02, p00),
+                     _mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(p12, p10), 1),
+                                   _mm_sub_epi16(p22, p20)));
+        /* gy = (p20 + 2*p21 + p22) - (p00 + 2*p01 + p02) */
+        __m128i gy = _mm_sub_epi16(
+            _mm_add_epi16(_mm_add_epi16(p20, p22), _mm_slli_epi16(p21, 1)),
+            _mm_add_epi16(_mm_add_epi16(p00, p02), _mm_slli_epi16(p01, 1)));
+
+        __m128i mag16;
+        if (mag_mode == MAG_APPROX)
+        {
+            /* |gx| + |gy| stays in 16-bit lanes (max 2040); no SSSE3 abs,
+               so build it from max(g, -g) */
+            const __m128i zero16 = _mm_setzero_si128();
+            __m128i abs_gx = _mm_max_epi16(gx, _mm_sub_epi16(zero16, gx));
+            __m128i abs_gy = _mm_max_epi16(gy, _mm_sub_epi16(zero16, gy));
+            mag16 = _mm_add_epi16(abs_gx, abs_gy);
+        }
+        else
+        {
+            /* 32-bit gx*gx + gy*gy via mullo/mulhi interleave */
+            __m128i gx_lo = _mm_mullo_epi16(gx, gx);
+            __m128i gx_hi = _mm_mulhi_epi16(gx, gx);
+            __m128i gy_lo = _mm_mullo_epi16(gy, gy);
+            __m128i gy_hi = _mm_mulhi_epi16(gy, gy);
+            __m128i sq_lo = _mm_add_epi32(_mm_unpacklo_epi16(gx_lo, gx_hi),
+                                          _mm_unpacklo_epi16(gy_lo, gy_hi));
+            __m128i sq_hi = _mm_add_epi32(_mm_unpackhi_epi16(gx_lo, gx_hi),
+                                          _mm_unpackhi_epi16(gy_lo, gy_hi));
+
+            /* sqrt on 4 floats at a time, truncating like the scalar (int)sqrt */
+            __m128i mag_lo = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_lo)));
+            __m128i mag_hi = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_hi)));
+            mag16 = _mm_packs_epi32(mag_lo, mag_hi);
+        }
+
+        /* Pack back to bytes; packus saturates anything above 255 */
+        __m128i mag8 = _mm_packus_epi16(mag16, mag16);
+        _mm_storel_epi64((__m128i *)(dst_row + x), mag8);
     }
+
+    if (x < width - 1)
+        sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, x, width - 1);
 }
+#endif /* __SSE2__ */
 
 /*
-What are gx and gy?
-- gx is the discrete approximation of the derivative in the x (horizontal) direction.
-- gy is the derivative in the y (vertical) direction.
-They are computed by convolving the 3×3 neighborhood with the Sobel kernels.
+GPU offload backend (--gpu). OpenMP target offload keeps this inside the
+toolchain OMP_FLAGS already builds with: on a node with a device the
+runtime stages src up, runs the stencil across the teams, and stages dst
+back; with no device (omp_get_num_devices() == 0) the target region
+executes on the initial device -- the host -- so --gpu degrades to a
+working CPU run and says so, which is also how this path is validated on
+machines without a GPU. The kernels are the same clamped 3x3 stencil as
+the host path but fully branch-clamped per pixel (no SIMD edge peeling
+to replicate on a device), and the fused variant compares squared
+magnitudes so no sqrt reaches the device. The map clauses put the whole
+frame resident per call; with the arena recycling the same host buffers
+every frame in batch mode, runtimes that pin and cache mappings get the
+async-DMA staging behaviour for free rather than us hand-rolling pinned
+buffers here.
 */
+static bool gpu_mode = false;
+
+static void gpu_report(void)
+{
+    static int reported = 0;
+    if (reported)
+        return;
+    reported = 1;
+    int devices = omp_get_num_devices();
+    if (devices > 0)
+        printf("GPU offload: %d device(s), using device %d\n",
+               devices, omp_get_default_device());
+    else
+        printf("GPU offload: no device present, target regions run on the host\n");
+}
+
+static void sobel_magnitude_gpu(const Image *input, Image *magnitude)
+{
+    const int width = input->width, height = input->height;
+    const size_t n = (size_t)width * height;
+    const unsigned char *src = input->data;
+    unsigned char *dst = magnitude->data;
+    const int approx = (mag_mode == MAG_APPROX);
+
+    gpu_report();
+    #pragma omp target teams distribute parallel for collapse(2) \
+        map(to : src[0 : n]) map(from : dst[0 : n])
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            int ym1 = (y == 0) ? 0 : y - 1;
+            int yp1 = (y == height - 1) ? y : y + 1;
+            int xm1 = (x == 0) ? 0 : x - 1;
+            int xp1 = (x == width - 1) ? x : x + 1;
+            const unsigned char *row_m1 = src + (size_t)ym1 * width;
+            const unsigned char *row_0 = src + (size_t)y * width;
+            const unsigned char *row_p1 = src + (size_t)yp1 * width;
+
+            int gx = -row_m1[xm1] + row_m1[xp1]
+                     - 2 * row_0[xm1] + 2 * row_0[xp1]
+                     - row_p1[xm1] + row_p1[xp1];
+            int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                     + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+
+            int mag;
+            if (approx)
+            {
+                int ax = gx < 0 ? -gx : gx;
+                int ay = gy < 0 ? -gy : gy;
+                mag = ax + ay;
+            }
+            else
+            {
+                mag = (int)sqrt((double)(gx * gx + gy * gy));
+            }
+            if (mag > 255)
+                mag = 255;
+            dst[(size_t)y * width + x] = (unsigned char)mag;
+        }
+    }
+}
+
+static void sobel_threshold_gpu(const Image *input, Image *out, int threshold)
+{
+    const int width = input->width, height = input->height;
+    const size_t n = (size_t)width * height;
+    const unsigned char *src = input->data;
+    unsigned char *dst = out->data;
+    const int approx = (mag_mode == MAG_APPROX);
+    const int thr_sq = threshold * threshold;
+
+    gpu_report();
+    #pragma omp target teams distribute parallel for collapse(2) \
+        map(to : src[0 : n]) map(from : dst[0 : n])
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            int ym1 = (y == 0) ? 0 : y - 1;
+            int yp1 = (y == height - 1) ? y : y + 1;
+            int xm1 = (x == 0) ? 0 : x - 1;
+            int xp1 = (x == width - 1) ? x : x + 1;
+            const unsigned char *row_m1 = src + (size_t)ym1 * width;
+            const unsigned char *row_0 = src + (size_t)y * width;
+            const unsigned char *row_p1 = src + (size_t)yp1 * width;
+
+            int gx = -row_m1[xm1] + row_m1[xp1]
+                     - 2 * row_0[xm1] + 2 * row_0[xp1]
+                     - row_p1[xm1] + row_p1[xp1];
+            int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                     + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+
+            int edge;
+            if (approx)
+            {
+                int ax = gx < 0 ? -gx : gx;
+                int ay = gy < 0 ? -gy : gy;
+                edge = (ax + ay >= threshold);
+            }
+            else
+            {
+                edge = (gx * gx + gy * gy >= thr_sq);
+            }
+            dst[(size_t)y * width + x] = edge ? 255 : 0;
+        }
+    }
+}
 
 static void sobel_magnitude(const Image *input, Image *magnitude)
 {
-    #pragma omp parallel for collapse(2)
+    if (gpu_mode)
+    {
+        sobel_magnitude_gpu(input, magnitude);
+        return;
+    }
+
+    /* Rows are independent, so each thread takes a contiguous block of rows
+       and runs the SIMD kernel over its interior columns. */
+    #pragma omp parallel for schedule(static)
     for (int y = 0; y < input->height; y++)
     {
-        for (int x = 0; x < input->width; x++)
+        const unsigned char *row_m1 = input->data + (size_t)((y == 0) ? 0 : y - 1) * input->width;
+        const unsigned char *row_0 = input->data + (size_t)y * input->width;
+        const unsigned char *row_p1 = input->data + (size_t)((y == input->height - 1) ? y : y + 1) * input->width;
+        unsigned char *dst_row = magnitude->data + (size_t)y * input->width;
+
+#ifdef __SSE2__
+        sobel_row_simd(row_m1, row_0, row_p1, dst_row, input->width);
+#else
+        sobel_row_scalar(row_m1, row_0, row_p1, dst_row, input->width, 0, input->width);
+#endif
+    }
+}
+
+/*
+Fused Sobel + threshold: writes the binary edge byte directly instead of
+materializing the magnitude image and re-reading it in a second pass. In
+exact mode the comparison runs on gx*gx + gy*gy against the squared
+threshold ((int)sqrt(s) >= t  <=>  s >= t*t for integer t), so the fused
+kernel needs no sqrt at all; approx mode compares |gx| + |gy| directly.
+*/
+static void sobel_threshold_row_scalar(const unsigned char *row_m1, const unsigned char *row_0,
+                                       const unsigned char *row_p1, unsigned char *dst_row,
+                                       int width, int x0, int x1, int threshold)
+{
+    int threshold_sq = threshold * threshold;
+    for (int x = x0; x < x1; x++)
+    {
+        int xm1 = (x == 0) ? 0 : x - 1;
+        int xp1 = (x == width - 1) ? width - 1 : x + 1;
+
+        int gx = -row_m1[xm1] + row_m1[xp1]
+                 - 2 * row_0[xm1] + 2 * row_0[xp1]
+                 - row_p1[xm1] + row_p1[xp1];
+        int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                 + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+
+        int edge;
+        if (mag_mode == MAG_APPROX)
+            edge = (abs(gx) + abs(gy) >= threshold);
+        else
+            edge = (gx * gx + gy * gy >= threshold_sq);
+        dst_row[x] = edge ? 255 : 0;
+    }
+}
+
+#ifdef __SSE2__
+/*
+SIMD fused Sobel + threshold. The compare produces 0/-1 lane masks and
+packs_epi16 turns -1 into 0xFF, so the 0/255 binary map falls out of the
+pack with no extra work. Compares use threshold-1 with cmpgt to get >=,
+which also handles threshold 0 (everything passes) correctly.
+*/
+static void sobel_threshold_row_simd(const unsigned char *row_m1, const unsigned char *row_0,
+                                     const unsigned char *row_p1, unsigned char *dst_row,
+                                     int width, int threshold)
+{
+    if (width < 2)
+    {
+        sobel_threshold_row_scalar(row_m1, row_0, row_p1, dst_row, width, 0, width, threshold);
+        return;
+    }
+
+    sobel_threshold_row_scalar(row_m1, row_0, row_p1, dst_row, width, 0, 1, threshold);
+    sobel_threshold_row_scalar(row_m1, row_0, row_p1, dst_row, width, width - 1, width, threshold);
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i thr_sq_m1 = _mm_set1_epi32(threshold * threshold - 1);
+    const __m128i thr_m1 = _mm_set1_epi16((short)(threshold - 1));
+    int x = 1;
+    for (; x + 8 <= width - 1; x += 8)
+    {
+        __m128i p00 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x - 1)), zero);
+        __m128i p01 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x)), zero);
+        __m128i p02 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x + 1)), zero);
+        __m128i p10 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_0 + x - 1)), zero);
+        __m128i p12 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_0 + x + 1)), zero);
+        __m128i p20 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x - 1)), zero);
+        __m128i p21 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x)), zero);
+        __m128i p22 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x + 1)), zero);
+
+        __m128i gx = _mm_add_epi16(_mm_sub_epi16(p02, p00),
+                     _mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(p12, p10), 1),
+                                   _mm_sub_epi16(p22, p20)));
+        __m128i gy = _mm_sub_epi16(
+            _mm_add_epi16(_mm_add_epi16(p20, p22), _mm_slli_epi16(p21, 1)),
+            _mm_add_epi16(_mm_add_epi16(p00, p02), _mm_slli_epi16(p01, 1)));
+
+        __m128i mask16;
+        if (mag_mode == MAG_APPROX)
+        {
+            __m128i abs_gx = _mm_max_epi16(gx, _mm_sub_epi16(zero, gx));
+            __m128i abs_gy = _mm_max_epi16(gy, _mm_sub_epi16(zero, gy));
+            mask16 = _mm_cmpgt_epi16(_mm_add_epi16(abs_gx, abs_gy), thr_m1);
+        }
+        else
         {
-            int gx = 0;
-            int gy = 0;
+            __m128i gx_lo = _mm_mullo_epi16(gx, gx);
+            __m128i gx_hi = _mm_mulhi_epi16(gx, gx);
+            __m128i gy_lo = _mm_mullo_epi16(gy, gy);
+            __m128i gy_hi = _mm_mulhi_epi16(gy, gy);
+            __m128i sq_lo = _mm_add_epi32(_mm_unpacklo_epi16(gx_lo, gx_hi),
+                                          _mm_unpacklo_epi16(gy_lo, gy_hi));
+            __m128i sq_hi = _mm_add_epi32(_mm_unpackhi_epi16(gx_lo, gx_hi),
+                                          _mm_unpackhi_epi16(gy_lo, gy_hi));
+            mask16 = _mm_packs_epi32(_mm_cmpgt_epi32(sq_lo, thr_sq_m1),
+                                     _mm_cmpgt_epi32(sq_hi, thr_sq_m1));
+        }
 
-            gx += -1 * get_pixel(input, x - 1, y - 1) + 1 * get_pixel(input, x + 1, y - 1);
-            gx += -2 * get_pixel(input, x - 1, y + 0) + 2 * get_pixel(input, x + 1, y + 0);
-            gx += -1 * get_pixel(input, x - 1, y + 1) + 1 * get_pixel(input, x + 1, y + 1);
+        __m128i edge8 = _mm_packs_epi16(mask16, mask16);
+        _mm_storel_epi64((__m128i *)(dst_row + x), edge8);
+    }
 
-            gy += -1 * get_pixel(input, x - 1, y - 1) + -2 * get_pixel(input, x + 0, y - 1) + -1 * get_pixel(input, x + 1, y - 1);
-            gy += 1 * get_pixel(input, x - 1, y + 1) + 2 * get_pixel(input, x + 0, y + 1) + 1 * get_pixel(input, x + 1, y + 1);
+    if (x < width - 1)
+        sobel_threshold_row_scalar(row_m1, row_0, row_p1, dst_row, width, x, width - 1, threshold);
+}
+#endif /* __SSE2__ */
 
-            int mag = (int)sqrt((double)(gx * gx + gy * gy));
-            if (mag > 255)
-                mag = 255;
-            if (mag < 0)
-                mag = 0;
-            set_pixel(magnitude, x, y, (unsigned char)mag);
+static void sobel_threshold_image(const Image *input, Image *out, unsigned char threshold)
+{
+    if (gpu_mode)
+    {
+        sobel_threshold_gpu(input, out, threshold);
+        return;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < input->height; y++)
+    {
+        const unsigned char *row_m1 = input->data + (size_t)((y == 0) ? 0 : y - 1) * input->width;
+        const unsigned char *row_0 = input->data + (size_t)y * input->width;
+        const unsigned char *row_p1 = input->data + (size_t)((y == input->height - 1) ? y : y + 1) * input->width;
+        unsigned char *dst_row = out->data + (size_t)y * input->width;
+
+#ifdef __SSE2__
+        sobel_threshold_row_simd(row_m1, row_0, row_p1, dst_row, input->width, threshold);
+#else
+        sobel_threshold_row_scalar(row_m1, row_0, row_p1, dst_row, input->width, 0, input->width, threshold);
+#endif
+    }
+}
+
+/*
+Phase-level instrumentation. Every binary reports the same four phases
+(decode, sobel, threshold, encode) as wall-clock seconds plus effective
+MPix/s, and --csv=<file> appends one row per phase in the schema that
+phase3/metrics.csv and phase3/performance/run_analysis.py already use
+(timestamp,latency,status,server), with server = "<binary>:<phase>".
+*/
+static const char *metrics_csv_path = NULL;
+
+static double now_seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void metrics_log_phase(const char *binary, const char *phase, double seconds)
+{
+    if (!metrics_csv_path)
+        return;
+    FILE *file = fopen(metrics_csv_path, "a");
+    if (!file)
+        return;
+    if (ftell(file) == 0)
+        fprintf(file, "timestamp,latency,status,server\n");
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fprintf(file, "%.6f,%f,SUCCESS,%s:%s\n",
+            ts.tv_sec + ts.tv_nsec * 1e-9, seconds, binary, phase);
+    fclose(file);
+}
+
+static void report_phases(const char *binary, int width, int height,
+                          double decode_s, double sobel_s, double threshold_s,
+                          double encode_s)
+{
+    double mpix = (double)width * height / 1e6;
+    double total = decode_s + sobel_s + threshold_s + encode_s;
+    printf("Phase timings: decode=%.6f sobel=%.6f threshold=%.6f encode=%.6f total=%.6f s\n",
+           decode_s, sobel_s, threshold_s, encode_s, total);
+    printf("Processed %.2f MPix (%zu bytes) at %.1f MPix/s (sobel phase), %.1f MPix/s end-to-end\n",
+           mpix, (size_t)width * height,
+           sobel_s > 0 ? mpix / sobel_s : 0.0, total > 0 ? mpix / total : 0.0);
+    metrics_log_phase(binary, "decode", decode_s);
+    metrics_log_phase(binary, "sobel", sobel_s);
+    metrics_log_phase(binary, "threshold", threshold_s);
+    metrics_log_phase(binary, "encode", encode_s);
+    metrics_log_phase(binary, "total", total);
+}
+
+/*
+Batch mode: instead of one image per process launch, take a directory (or a
+text file listing one path per line) and run a three-stage pipeline:
+
+    decoder thread  ->  [queue]  ->  compute (main thread + OpenMP team)  ->  [queue]  ->  writer thread
+
+so image N+1 decodes and image N-1 writes while image N runs the Sobel
+kernel. Queues are small bounded rings guarded by a mutex/condvar pair.
+*/
+
+#define BATCH_QUEUE_DEPTH 4
+
+typedef struct
+{
+    char in_path[MAX_PATH];
+    char out_path[MAX_PATH];
+    Image *img; /* decoded input between stages 1-2, edge map between stages 2-3 */
+} BatchItem;
+
+typedef struct
+{
+    BatchItem *items[BATCH_QUEUE_DEPTH];
+    int head;
+    int tail;
+    int count;
+    int done; /* producer finished, drain and exit */
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} BatchQueue;
+
+static void queue_init(BatchQueue *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_push(BatchQueue *q, BatchItem *item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == BATCH_QUEUE_DEPTH)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[q->tail] = item;
+    q->tail = (q->tail + 1) % BATCH_QUEUE_DEPTH;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* Returns NULL once the producer is done and the queue has drained */
+static BatchItem *queue_pop(BatchQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->done)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    if (q->count == 0)
+    {
+        pthread_mutex_unlock(&q->lock);
+        return NULL;
+    }
+    BatchItem *item = q->items[q->head];
+    q->head = (q->head + 1) % BATCH_QUEUE_DEPTH;
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+static void queue_mark_done(BatchQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->done = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static bool has_image_extension(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot)
+        return false;
+    return strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0 ||
+           strcasecmp(dot, ".png") == 0 || strcasecmp(dot, ".pgm") == 0 ||
+           strcasecmp(dot, ".bmp") == 0;
+}
+
+/*
+Build the list of input paths: a directory is scanned for image files, a
+regular file is read as one path per line. Returns a malloc'd array of
+malloc'd strings (caller frees) and sets *count.
+*/
+static char **collect_inputs(const char *arg, int *count)
+{
+    char **paths = NULL;
+    int n = 0, cap = 0;
+
+    struct stat st;
+    if (stat(arg, &st) != 0)
+    {
+        fprintf(stderr, "Error: Cannot stat %s\n", arg);
+        return NULL;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(arg);
+        if (!dir)
+        {
+            fprintf(stderr, "Error: Cannot open directory %s\n", arg);
+            return NULL;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (!has_image_extension(entry->d_name))
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                paths = (char **)realloc(paths, cap * sizeof(char *));
+            }
+            char *full = (char *)malloc(MAX_PATH * 2);
+            snprintf(full, MAX_PATH * 2, "%s/%s", arg, entry->d_name);
+            paths[n++] = full;
+        }
+        closedir(dir);
+    }
+    else
+    {
+        FILE *file = fopen(arg, "r");
+        if (!file)
+        {
+            fprintf(stderr, "Error: Cannot open list file %s\n", arg);
+            return NULL;
+        }
+        char line[MAX_PATH];
+        while (fgets(line, sizeof(line), file))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                paths = (char **)realloc(paths, cap * sizeof(char *));
+            }
+            paths[n++] = strdup(line);
+        }
+        fclose(file);
+    }
+
+    *count = n;
+    return paths;
+}
+
+/* output path: <outdir>/<input basename>.pgm */
+static void make_output_path(char *dst, size_t dst_size, const char *outdir, const char *in_path)
+{
+    const char *base = strrchr(in_path, '/');
+    base = base ? base + 1 : in_path;
+    const char *dot = strrchr(base, '.');
+    int stem_len = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(dst, dst_size, "%s/%.*s.pgm", outdir, stem_len, base);
+}
+
+typedef struct
+{
+    char **paths;
+    int count;
+    const char *outdir;
+    BatchQueue *out_queue;
+} DecoderArgs;
+
+static void *decoder_thread(void *arg)
+{
+    DecoderArgs *args = (DecoderArgs *)arg;
+    for (int i = 0; i < args->count; i++)
+    {
+        BatchItem *item = (BatchItem *)malloc(sizeof(BatchItem));
+        snprintf(item->in_path, sizeof(item->in_path), "%s", args->paths[i]);
+        make_output_path(item->out_path, sizeof(item->out_path), args->outdir, args->paths[i]);
+        item->img = load_image(args->paths[i]);
+        if (!item->img)
+        {
+            free(item); /* load_image already printed the error; skip the frame */
+            continue;
+        }
+        queue_push(args->out_queue, item);
+    }
+    queue_mark_done(args->out_queue);
+    return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+    BatchQueue *q = (BatchQueue *)arg;
+    BatchItem *item;
+    while ((item = queue_pop(q)) != NULL)
+    {
+        save_pgm(item->out_path, item->img);
+        free_image(item->img);
+        free(item);
+    }
+    return NULL;
+}
+
+static int run_batch(const char *input_arg, const char *outdir, unsigned char threshold)
+{
+    int count = 0;
+    char **paths = collect_inputs(input_arg, &count);
+    if (!paths || count == 0)
+    {
+        fprintf(stderr, "Error: No input images found in %s\n", input_arg);
+        free(paths);
+        return 1;
+    }
+
+    /* One big region up front; per-frame buffers recycle out of it */
+    image_arena_init((size_t)512 * 1024 * 1024);
+
+    printf("Batch mode: %d images, %d threads, output dir %s\n",
+           count, omp_get_max_threads(), outdir);
+
+    BatchQueue decoded, computed;
+    queue_init(&decoded);
+    queue_init(&computed);
+
+    DecoderArgs dargs = {paths, count, outdir, &decoded};
+    pthread_t decoder, writer;
+    pthread_create(&decoder, NULL, decoder_thread, &dargs);
+    pthread_create(&writer, NULL, writer_thread, &computed);
+
+    double start = omp_get_wtime();
+    int processed = 0;
+
+    /* Compute stage runs on the main thread so the OpenMP team inside
+       sobel_magnitude() stays warm across frames. */
+    BatchItem *item;
+    while ((item = queue_pop(&decoded)) != NULL)
+    {
+        Image *out = create_image(item->img->width, item->img->height, 255);
+        if (!out)
+        {
+            fprintf(stderr, "Error: Out of memory\n");
+            free_image(item->img);
+            free(item);
+            continue;
         }
+        if (numa_mode)
+            first_touch_rows(out->data, out->width, out->height);
+        sobel_threshold_image(item->img, out, threshold);
+        free_image(item->img);
+        item->img = out;
+        queue_push(&computed, item);
+        processed++;
     }
+    queue_mark_done(&computed);
+
+    pthread_join(decoder, NULL);
+    pthread_join(writer, NULL);
+
+    double elapsed = omp_get_wtime() - start;
+    printf("Processed %d/%d images in %.3f seconds (%.1f images/s)\n",
+           processed, count, elapsed, processed / (elapsed > 0 ? elapsed : 1));
+
+    for (int i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+    return processed == count ? 0 : 1;
 }
 
+
 /*
-Converts gradient magnitudes into a binary image:
-If mag >= threshold then pixel becomes 255 (white = edge).
-Else becomes 0 (black = not edge).
+Server mode: a long-lived daemon on a unix socket, so the thread pool,
+the output buffers, and the process itself stay warm across requests.
+For small frames the cold-start cost (thread creation on the first
+parallel region plus process launch) otherwise dominates per-frame
+latency. Connections are served by SERVER_WORKERS pthreads, each owning
+a pre-allocated output Image that is reused across its requests, so
+concurrent RPCs (the phase3 gRPC front-end runs four) process in
+parallel with zero steady-state allocation. phase3/server/sobel_server.py
+terminates the gRPC protocol and forwards each request as one line here.
+
+Protocol, one request per line:
+    <input_path> <output_path> [threshold]\n
+Reply:
+    OK <seconds>\n   or   ERR <message>\n
+A line reading "shutdown" stops the daemon.
+
+Zero-copy transport for co-located clients: when the client runs on the
+same host, going through files (or serializing pixels over a socket)
+costs two copies per direction for data that never leaves the machine.
+Instead the client creates two POSIX shared-memory regions (shm_open),
+fills one with raw 8-bit grayscale pixels, and sends only a descriptor
+line:
+    shm <in_shm_name> <out_shm_name> <W>x<H> [threshold]\n
+The worker maps both regions and runs the fused kernel straight out of
+the input mapping into the output mapping -- no pixel ever crosses the
+socket and nothing is copied. The client owns the regions' lifecycle
+(it can reuse them as a ring across frames); the server maps and
+unmaps per request, which is nanoseconds against an 8 MB frame copy.
 */
 
-static void threshold_image(const Image *src, Image *dst, unsigned char threshold)
+#define SERVER_WORKERS 4
+
+/* Ring of accepted connection fds feeding the worker pool */
+typedef struct
+{
+    int fds[SERVER_WORKERS * 2];
+    int head;
+    int tail;
+    int count;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} ConnQueue;
+
+static void conn_queue_init(ConnQueue *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void conn_queue_push(ConnQueue *q, int fd)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == SERVER_WORKERS * 2)
+        pthread_cond_wait(&q->not_full, &q->lock);
+    q->fds[q->tail] = fd;
+    q->tail = (q->tail + 1) % (SERVER_WORKERS * 2);
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+/* Returns -1 once the server is shutting down and the queue has drained */
+static int conn_queue_pop(ConnQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->done)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    if (q->count == 0)
+    {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    int fd = q->fds[q->head];
+    q->head = (q->head + 1) % (SERVER_WORKERS * 2);
+    q->count--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return fd;
+}
+
+static void conn_queue_shutdown(ConnQueue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->done = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static ConnQueue server_conns;
+static volatile int server_shutdown = 0;
+static unsigned char server_default_threshold = 100;
+
+/* Per-worker output buffer, reallocated only when dimensions change */
+static int serve_request(Image **out_slot, const char *in_path, const char *out_path,
+                         unsigned char threshold, double *elapsed)
+{
+    Image *input = load_image(in_path);
+    if (!input)
+        return -1;
+
+    Image *out = *out_slot;
+    if (!out || out->width != input->width || out->height != input->height)
+    {
+        free_image(out);
+        out = create_image(input->width, input->height, 255);
+        *out_slot = out;
+        if (!out)
+        {
+            free_image(input);
+            return -1;
+        }
+        if (numa_mode)
+            first_touch_rows(out->data, out->width, out->height);
+    }
+
+    double start = omp_get_wtime();
+    sobel_threshold_image(input, out, threshold);
+    *elapsed = omp_get_wtime() - start;
+
+    int rc = save_pgm(out_path, out);
+    free_image(input);
+    return rc;
+}
+
+/* Map a shm region by name; len is validated against the object size */
+static void *map_shm(const char *name, size_t len, int writable)
+{
+    int fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < len)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *base = mmap(NULL, len, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                      MAP_SHARED, fd, 0);
+    close(fd);
+    return (base == MAP_FAILED) ? NULL : base;
+}
+
+/* args: "<in_shm> <out_shm> <W>x<H> [threshold]" */
+static int serve_shm_request(const char *args, unsigned char default_threshold,
+                             double *elapsed)
 {
-    int n = src->width * src->height;
-    #pragma omp parallel for
-    for (int i = 0; i < n; i++)
+    char in_name[MAX_PATH], out_name[MAX_PATH];
+    int width = 0, height = 0;
+    int t = default_threshold;
+    if (sscanf(args, "%255s %255s %dx%d %d", in_name, out_name, &width, &height, &t) < 4 ||
+        width <= 0 || height <= 0)
+        return -1;
+    if (t < 0)
+        t = 0;
+    if (t > 255)
+        t = 255;
+
+    size_t frame_bytes = (size_t)width * height;
+    void *in_base = map_shm(in_name, frame_bytes, 0);
+    void *out_base = in_base ? map_shm(out_name, frame_bytes, 1) : NULL;
+    if (!in_base || !out_base)
     {
-        dst->data[i] = (src->data[i] >= threshold) ? 255 : 0;
+        if (in_base)
+            munmap(in_base, frame_bytes);
+        return -1;
     }
+
+    /* Stack Image views over the mappings; no buffer is allocated */
+    Image in_img = {width, height, 255, (unsigned char *)in_base, NULL, 0};
+    Image out_img = {width, height, 255, (unsigned char *)out_base, NULL, 0};
+
+    double start = omp_get_wtime();
+    sobel_threshold_image(&in_img, &out_img, (unsigned char)t);
+    *elapsed = omp_get_wtime() - start;
+
+    munmap(in_base, frame_bytes);
+    munmap(out_base, frame_bytes);
+    return 0;
+}
+
+static void *server_worker_thread(void *arg)
+{
+    (void)arg;
+    Image *out = NULL; /* this worker's reusable buffer */
+
+    int conn_fd;
+    while ((conn_fd = conn_queue_pop(&server_conns)) >= 0)
+    {
+        FILE *conn = fdopen(conn_fd, "r+");
+        if (!conn)
+        {
+            close(conn_fd);
+            continue;
+        }
+
+        char line[2 * MAX_PATH + 32];
+        while (fgets(line, sizeof(line), conn))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            if (strcmp(line, "shutdown") == 0)
+            {
+                fprintf(conn, "OK bye\n");
+                server_shutdown = 1;
+                break;
+            }
+            if (strncmp(line, "shm ", 4) == 0)
+            {
+                double elapsed = 0.0;
+                if (serve_shm_request(line + 4, server_default_threshold, &elapsed) == 0)
+                    fprintf(conn, "OK %.6f\n", elapsed);
+                else
+                    fprintf(conn, "ERR expected: shm <in_shm> <out_shm> <WxH> [threshold]\n");
+                fflush(conn);
+                continue;
+            }
+
+            char in_path[MAX_PATH], out_path[MAX_PATH];
+            int t = server_default_threshold;
+            int n = sscanf(line, "%255s %255s %d", in_path, out_path, &t);
+            if (n < 2)
+            {
+                fprintf(conn, "ERR expected: <input> <output> [threshold]\n");
+                fflush(conn);
+                continue;
+            }
+            if (t < 0)
+                t = 0;
+            if (t > 255)
+                t = 255;
+
+            double elapsed = 0.0;
+            if (serve_request(&out, in_path, out_path, (unsigned char)t, &elapsed) == 0)
+                fprintf(conn, "OK %.6f\n", elapsed);
+            else
+                fprintf(conn, "ERR failed to process %s\n", in_path);
+            fflush(conn);
+        }
+        fclose(conn);
+    }
+
+    free_image(out);
+    return NULL;
+}
+
+static int run_server(const char *socket_path, unsigned char default_threshold)
+{
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    unlink(socket_path);
+
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0)
+    {
+        perror("bind/listen");
+        close(listen_fd);
+        return 1;
+    }
+
+    image_arena_init((size_t)512 * 1024 * 1024);
+    server_default_threshold = default_threshold;
+    conn_queue_init(&server_conns);
+
+    pthread_t workers[SERVER_WORKERS];
+    for (int i = 0; i < SERVER_WORKERS; i++)
+        pthread_create(&workers[i], NULL, server_worker_thread, NULL);
+
+    /* Spin the OpenMP team up once so the first request doesn't pay
+       thread-creation cost. */
+    #pragma omp parallel
+    {
+        #pragma omp single
+        printf("Server ready on %s with %d workers x %d threads\n",
+               socket_path, SERVER_WORKERS, omp_get_num_threads());
+    }
+    fflush(stdout);
+
+    while (!server_shutdown)
+    {
+        /* Wake from accept() periodically to notice a worker-side shutdown */
+        struct timeval tv = {0, 200000};
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(listen_fd, &rfds);
+        if (select(listen_fd + 1, &rfds, NULL, NULL, &tv) <= 0)
+            continue;
+        int conn_fd = accept(listen_fd, NULL, NULL);
+        if (conn_fd < 0)
+            continue;
+        conn_queue_push(&server_conns, conn_fd);
+    }
+
+    conn_queue_shutdown(&server_conns);
+    for (int i = 0; i < SERVER_WORKERS; i++)
+        pthread_join(workers[i], NULL);
+
+    close(listen_fd);
+    unlink(socket_path);
+    return 0;
+}
+
+
+/*
+Raw streaming mode (--stream-raw WxH): frames arrive as raw 8-bit
+grayscale on stdin (a pipe from a camera process, or a socket via
+nc/socat) and binary edge maps leave on stdout, one WxH block per frame
+with no headers. The same two bounded queues as batch mode give the
+read / compute / write overlap: the reader thread fills frame N+1 while
+the OpenMP team runs Sobel on frame N and the writer thread pushes frame
+N-1 downstream. With the arena recycling blocks by size, steady state is
+three input and three output buffers rotating with zero allocation --
+triple buffering without a dedicated buffer manager.
+
+All diagnostics go to stderr here; stdout is the video stream.
+*/
+
+static int read_full_frame(FILE *file, unsigned char *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        size_t n = fread(buf + got, 1, len - got, file);
+        if (n == 0)
+            return (got == 0) ? 0 : -1; /* clean EOF vs torn frame */
+        got += n;
+    }
+    return 1;
+}
+
+typedef struct
+{
+    int width;
+    int height;
+    BatchQueue *out_queue;
+} StreamReaderArgs;
+
+static void *stream_reader_thread(void *arg)
+{
+    StreamReaderArgs *args = (StreamReaderArgs *)arg;
+    size_t frame_bytes = (size_t)args->width * args->height;
+    for (;;)
+    {
+        Image *img = create_image(args->width, args->height, 255);
+        if (!img)
+        {
+            fprintf(stderr, "Error: Out of memory in stream reader\n");
+            break;
+        }
+        int rc = read_full_frame(stdin, img->data, frame_bytes);
+        if (rc != 1)
+        {
+            if (rc < 0)
+                fprintf(stderr, "Warning: dropping torn frame at end of stream\n");
+            free_image(img);
+            break;
+        }
+        BatchItem *item = (BatchItem *)malloc(sizeof(BatchItem));
+        item->in_path[0] = item->out_path[0] = '\0';
+        item->img = img;
+        queue_push(args->out_queue, item);
+    }
+    queue_mark_done(args->out_queue);
+    return NULL;
+}
+
+typedef struct
+{
+    BatchQueue *queue;
+    long frames;
+} StreamWriterArgs;
+
+static void *stream_writer_thread(void *arg)
+{
+    StreamWriterArgs *args = (StreamWriterArgs *)arg;
+    BatchItem *item;
+    while ((item = queue_pop(args->queue)) != NULL)
+    {
+        size_t len = (size_t)item->img->width * item->img->height;
+        if (fwrite(item->img->data, 1, len, stdout) != len)
+        {
+            fprintf(stderr, "Error: Short write on stdout, stopping\n");
+            free_image(item->img);
+            free(item);
+            break;
+        }
+        fflush(stdout);
+        args->frames++;
+        free_image(item->img);
+        free(item);
+    }
+    return NULL;
+}
+
+static int run_stream_raw(int width, int height, unsigned char threshold)
+{
+    if (width <= 0 || height <= 0)
+    {
+        fprintf(stderr, "Error: --stream-raw needs a WxH frame size\n");
+        return 1;
+    }
+
+    /* One big region up front; the six rotating frame buffers live here */
+    image_arena_init((size_t)512 * 1024 * 1024);
+
+    fprintf(stderr, "Streaming %dx%d raw frames, %d threads\n",
+            width, height, omp_get_max_threads());
+
+    BatchQueue decoded, computed;
+    queue_init(&decoded);
+    queue_init(&computed);
+
+    StreamReaderArgs rargs = {width, height, &decoded};
+    StreamWriterArgs wargs = {&computed, 0};
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, stream_reader_thread, &rargs);
+    pthread_create(&writer, NULL, stream_writer_thread, &wargs);
+
+    double start = omp_get_wtime();
+
+    /* Compute stage on the main thread keeps the OpenMP team warm */
+    BatchItem *item;
+    while ((item = queue_pop(&decoded)) != NULL)
+    {
+        Image *out = create_image(item->img->width, item->img->height, 255);
+        if (!out)
+        {
+            fprintf(stderr, "Error: Out of memory\n");
+            free_image(item->img);
+            free(item);
+            continue;
+        }
+        if (numa_mode)
+            first_touch_rows(out->data, out->width, out->height);
+        sobel_threshold_image(item->img, out, threshold);
+        free_image(item->img);
+        item->img = out;
+        queue_push(&computed, item);
+    }
+    queue_mark_done(&computed);
+
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+
+    double elapsed = omp_get_wtime() - start;
+    fprintf(stderr, "Streamed %ld frames in %.3f seconds (%.1f fps)\n",
+            wargs.frames, elapsed, wargs.frames / (elapsed > 0 ? elapsed : 1));
+    return 0;
 }
 
 int main(int argc, char *argv[])
 {
+    bool magnitude_only = false;
+
+    /* Strip option flags before positional argument handling */
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--numa") == 0)
+        {
+            numa_mode = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--approx") == 0)
+        {
+            mag_mode = MAG_APPROX;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--magnitude") == 0)
+        {
+            magnitude_only = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strncmp(argv[i], "--csv=", 6) == 0)
+        {
+            metrics_csv_path = argv[i] + 6;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--gpu") == 0)
+        {
+            gpu_mode = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--odirect") == 0)
+        {
+            write_odirect = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--fdatasync") == 0)
+        {
+            write_fdatasync = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+    }
+
+    if (numa_mode)
+    {
+        /* Must happen before the OpenMP runtime initializes; setenv with
+           overwrite=0 respects pinning the user already configured */
+        setenv("OMP_PROC_BIND", "spread", 0);
+        setenv("OMP_PLACES", "cores", 0);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--stream-raw") == 0)
+    {
+        int width = 0, height = 0;
+        if (sscanf(argv[2], "%dx%d", &width, &height) != 2)
+        {
+            fprintf(stderr, "Error: --stream-raw expects WxH, got %s\n", argv[2]);
+            return 1;
+        }
+        unsigned char threshold = 100;
+        if (argc >= 4)
+        {
+            int t = atoi(argv[3]);
+            if (t < 0)
+                t = 0;
+            if (t > 255)
+                t = 255;
+            threshold = (unsigned char)t;
+        }
+        return run_stream_raw(width, height, threshold);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--serve") == 0)
+    {
+        unsigned char threshold = 100;
+        if (argc >= 4)
+        {
+            int t = atoi(argv[3]);
+            if (t < 0)
+                t = 0;
+            if (t > 255)
+                t = 255;
+            threshold = (unsigned char)t;
+        }
+        return run_server(argv[2], threshold);
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "--batch") == 0)
+    {
+        unsigned char threshold = 100;
+        if (argc >= 5)
+        {
+            int t = atoi(argv[4]);
+            if (t < 0)
+                t = 0;
+            if (t > 255)
+                t = 255;
+            threshold = (unsigned char)t;
+        }
+        return run_batch(argv[2], argv[3], threshold);
+    }
+
     if (argc < 3)
     {
         fprintf(stderr, "Usage: %s <input_image> <output_image.pgm> [threshold]\n", argv[0]);
+        fprintf(stderr, "       %s --batch <input_dir|list.txt> <output_dir> [threshold]\n", argv[0]);
+        fprintf(stderr, "       %s --serve <socket_path> [threshold]\n", argv[0]);
+        fprintf(stderr, "       %s --stream-raw <WxH> [threshold]  (raw frames stdin -> stdout)\n", argv[0]);
         fprintf(stderr, "  threshold: Edge detection threshold (default: 100)\n");
+        fprintf(stderr, "  --approx:  Integer |gx|+|gy| magnitude (no per-pixel sqrt)\n");
+        fprintf(stderr, "  --magnitude: Write raw gradient magnitudes instead of the binary map\n");
+        fprintf(stderr, "  --numa:    Pin threads and first-touch buffers per socket\n");
+        fprintf(stderr, "  --gpu:     OpenMP target offload (host fallback without a device)\n");
+        fprintf(stderr, "  --csv=FILE: Append per-phase timings in the phase3 metrics.csv schema\n");
+        fprintf(stderr, "  --odirect: Write output with O_DIRECT (bypass the page cache)\n");
+        fprintf(stderr, "  --fdatasync: fdatasync each output before continuing\n");
         return 1;
     }
 
@@ -183,46 +1762,51 @@ int main(int argc, char *argv[])
     }
 
     printf("Loading image: %s\n", argv[1]);
+    double t0 = now_seconds();
     Image *input = load_image(argv[1]);
+    double decode_s = now_seconds() - t0;
     if (!input)
     {
         return 1;
     }
     printf("Image loaded: %dx%d\n", input->width, input->height);
 
-    Image *mag = create_image(input->width, input->height, 255);
-    if (!mag)
-    {
-        free_image(input);
-        fprintf(stderr, "Error: Out of memory\n");
-        return 1;
-    }
-    double start = omp_get_wtime();
-    sobel_magnitude(input, mag);
-
+    /* One output buffer is enough: the fused kernel writes the binary edge
+       map directly, and --magnitude writes raw magnitudes into the same
+       buffer. The intermediate mag image is never materialized. */
     Image *out = create_image(input->width, input->height, 255);
     if (!out)
     {
-        free_image(mag);
         free_image(input);
         fprintf(stderr, "Error: Out of memory\n");
         return 1;
     }
-    threshold_image(mag, out, threshold);
+    if (numa_mode)
+        first_touch_rows(out->data, out->width, out->height);
+    double start = omp_get_wtime();
+    if (magnitude_only)
+        sobel_magnitude(input, out);
+    else
+        sobel_threshold_image(input, out, threshold);
     double end = omp_get_wtime();
     printf("Parallel for version runtime: %.6f seconds\n", end - start);
 
     printf("Saving output image: %s\n", argv[2]);
-    if (save_pgm(argv[2], out) != 0)
+    t0 = now_seconds();
+    int save_rc = save_pgm(argv[2], out);
+    double encode_s = now_seconds() - t0;
+    if (save_rc != 0)
     {
         free_image(out);
-        free_image(mag);
         free_image(input);
         return 1;
     }
 
+    /* The fused kernel folds thresholding into the sobel phase */
+    report_phases("sobel_par", input->width, input->height,
+                  decode_s, end - start, 0.0, encode_s);
+
     free_image(out);
-    free_image(mag);
     free_image(input);
     printf("Done.\n");
     return 0;
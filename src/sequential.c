@@ -1,9 +1,19 @@
+#define _GNU_SOURCE /* O_DIRECT */
+
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
 #include <time.h>
+#include <pthread.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -15,10 +25,106 @@ typedef struct
     int width;
     int height;
     int max_val;
+    int channels; /* samples per pixel: 1 (gray) or 3 (interleaved RGB) */
+    int depth;    /* bytes per sample: 1 (8-bit) or 2 (native-endian 16-bit) */
     unsigned char *data;
+    void *map_base;  /* non-NULL when data points into an mmap'd PGM file */
+    size_t map_len;
 } Image;
 
-static Image *create_image(int width, int height, int max_val)
+
+/*
+Arena allocator: steady-state batch and server workloads allocate and
+free the same two or three multi-megabyte frame buffers over and over,
+which hammers the allocator and bounces pages back to the kernel between
+frames. image_arena_init() reserves one large anonymous mapping up front
+(hinted to use huge pages) and create_image() recycles fixed blocks out
+of it, so after the first frame there are zero mallocs and zero new page
+faults. Anything that does not fit falls back to plain malloc.
+*/
+
+#define ARENA_MAX_BLOCKS 16
+
+typedef struct
+{
+    unsigned char *ptr;
+    size_t size;
+    int in_use;
+} ArenaBlock;
+
+static unsigned char *arena_base = NULL;
+static size_t arena_size = 0;
+static size_t arena_used = 0;
+static ArenaBlock arena_blocks[ARENA_MAX_BLOCKS];
+static int arena_block_count = 0;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int image_arena_init(size_t bytes)
+{
+    void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return -1;
+#ifdef MADV_HUGEPAGE
+    madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+    arena_base = (unsigned char *)base;
+    arena_size = bytes;
+    arena_used = 0;
+    arena_block_count = 0;
+    return 0;
+}
+
+static unsigned char *arena_alloc(size_t size)
+{
+    if (!arena_base)
+        return NULL;
+    size = (size + 63) & ~(size_t)63; /* keep blocks cacheline aligned */
+
+    unsigned char *result = NULL;
+    pthread_mutex_lock(&arena_lock);
+    /* Recycle a free block of the same size first (the steady-state hit) */
+    for (int i = 0; i < arena_block_count; i++)
+    {
+        if (!arena_blocks[i].in_use && arena_blocks[i].size == size)
+        {
+            arena_blocks[i].in_use = 1;
+            result = arena_blocks[i].ptr;
+            break;
+        }
+    }
+    if (!result && arena_block_count < ARENA_MAX_BLOCKS && arena_used + size <= arena_size)
+    {
+        ArenaBlock *block = &arena_blocks[arena_block_count++];
+        block->ptr = arena_base + arena_used;
+        block->size = size;
+        block->in_use = 1;
+        arena_used += size;
+        result = block->ptr;
+    }
+    pthread_mutex_unlock(&arena_lock);
+    return result;
+}
+
+/* Returns 1 if ptr belonged to the arena (and is now recycled), 0 otherwise */
+static int arena_release(unsigned char *ptr)
+{
+    if (!arena_base || ptr < arena_base || ptr >= arena_base + arena_size)
+        return 0;
+    pthread_mutex_lock(&arena_lock);
+    for (int i = 0; i < arena_block_count; i++)
+    {
+        if (arena_blocks[i].ptr == ptr)
+        {
+            arena_blocks[i].in_use = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&arena_lock);
+    return 1;
+}
+
+static Image *create_image_fmt(int width, int height, int max_val, int channels, int depth)
 {
     Image *img = (Image *)malloc(sizeof(Image));
     if (!img)
@@ -26,7 +132,14 @@ static Image *create_image(int width, int height, int max_val)
     img->width = width;
     img->height = height;
     img->max_val = max_val;
-    img->data = (unsigned char *)malloc((size_t)width * (size_t)height);
+    img->channels = channels;
+    img->depth = depth;
+    img->map_base = NULL;
+    img->map_len = 0;
+    size_t bytes = (size_t)width * height * channels * depth;
+    img->data = arena_alloc(bytes);
+    if (!img->data)
+        img->data = (unsigned char *)malloc(bytes);
     if (!img->data)
     {
         free(img);
@@ -35,19 +148,145 @@ static Image *create_image(int width, int height, int max_val)
     return img;
 }
 
+static Image *create_image(int width, int height, int max_val)
+{
+    return create_image_fmt(width, height, max_val, 1, 1);
+}
+
 static void free_image(Image *img)
 {
     if (!img)
         return;
-    free(img->data);
+    if (img->map_base)
+        munmap(img->map_base, img->map_len);
+    else if (!arena_release(img->data))
+        free(img->data);
     free(img);
 }
 
+
+/*
+Native P5/PGM fast path: mmap() the file and point Image.data straight at
+the mapped pixel bytes -- no decode, no copy, no pixel allocation. Most
+pipeline inputs are 8-bit PGM produced upstream by convert_to_pgm.py, so
+this skips stb entirely for them; anything else (JPEG/PNG/...) still goes
+through stbi_load() below.
+*/
+static Image *load_pgm_mmap(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 10)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file open */
+    if (base == MAP_FAILED)
+        return NULL;
+
+    const char *p = (const char *)base;
+    const char *end = p + st.st_size;
+
+    if (p[0] != 'P' || p[1] != '5')
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    p += 2;
+
+    /* Parse width, height, maxval; whitespace and # comments may separate them */
+    int fields[3];
+    for (int i = 0; i < 3; i++)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '#'))
+        {
+            if (*p == '#')
+                while (p < end && *p != '\n')
+                    p++;
+            else
+                p++;
+        }
+        int value = 0;
+        if (p >= end || *p < '0' || *p > '9')
+        {
+            munmap(base, (size_t)st.st_size);
+            return NULL;
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+        fields[i] = value;
+    }
+    p++; /* exactly one whitespace byte separates maxval from pixel data */
+
+    int width = fields[0], height = fields[1], max_val = fields[2];
+    int depth = (max_val > 255) ? 2 : 1;
+    if (width <= 0 || height <= 0 || max_val <= 0 || max_val > 65535 ||
+        end - p < (long)((size_t)width * height * depth))
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    if (depth == 2)
+    {
+        /* 16-bit PGM samples are big-endian on disk, so the zero-copy trick
+           does not apply: swap into a native-endian uint16 buffer. This is
+           still the full-precision path the medical sets need -- stb would
+           quantize these to 8 bits. */
+        Image *img = create_image_fmt(width, height, max_val, 1, 2);
+        if (!img)
+        {
+            munmap(base, (size_t)st.st_size);
+            return NULL;
+        }
+        const unsigned char *src = (const unsigned char *)p;
+        uint16_t *dst = (uint16_t *)img->data;
+        size_t n = (size_t)width * height;
+        for (size_t i = 0; i < n; i++)
+            dst[i] = (uint16_t)((src[2 * i] << 8) | src[2 * i + 1]);
+        munmap(base, (size_t)st.st_size);
+        return img;
+    }
+
+    Image *img = (Image *)malloc(sizeof(Image));
+    if (!img)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    img->width = width;
+    img->height = height;
+    img->max_val = max_val;
+    img->channels = 1;
+    img->depth = 1;
+    img->map_base = base;
+    img->map_len = (size_t)st.st_size;
+    img->data = (unsigned char *)p; /* zero-copy: points into the mapping */
+    return img;
+}
+
+/* --rgb: keep color inputs as interleaved 3-channel instead of letting stb
+   collapse them to grayscale (the lossy pre-conversion the Python pipeline
+   used to do) */
+static bool rgb_mode = false;
+
 // loading image using stb_image as 1-channel grayscale
 static Image *load_image(const char *filename)
 {
+    /* 8-bit PGM inputs map straight from disk; everything else decodes via stb */
+    Image *mapped = load_pgm_mmap(filename);
+    if (mapped)
+        return mapped;
+
     int width, height, channels;
-    unsigned char *data = stbi_load(filename, &width, &height, &channels, 1); // Force 1 channel (grayscale)
+    int want = rgb_mode ? 3 : 1; // default: force 1 channel (grayscale)
+    unsigned char *data = stbi_load(filename, &width, &height, &channels, want);
 
     if (!data)
     {
@@ -55,22 +294,86 @@ static Image *load_image(const char *filename)
         return NULL;
     }
 
-    Image *img = create_image(width, height, 255);
+    Image *img = create_image_fmt(width, height, 255, want, 1);
     if (!img)
     {
         stbi_image_free(data);
         return NULL;
     }
 
-    // Copy grayscale data
-    memcpy(img->data, data, width * height);
+    memcpy(img->data, data, (size_t)width * height * want);
     stbi_image_free(data);
 
     return img;
 }
 
+/*
+Output write policy. --fdatasync makes each frame durable before the
+writer moves on (the belt-and-braces option for flaky NFS mounts);
+--odirect bypasses the page cache entirely, which avoids evicting the
+input working set when dumping large batches to slow storage. O_DIRECT
+needs block-aligned buffers and sizes, so it stages through one aligned
+bounce buffer and trims the padding with ftruncate; filesystems that
+reject O_DIRECT (tmpfs) silently fall back to the buffered path.
+*/
+static bool write_odirect = false;
+static bool write_fdatasync = false;
+
+static int save_pgm_direct(const char *filename, Image *img)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0)
+        return 1; /* caller falls back to the buffered path */
+
+    char header[64];
+    int hlen = snprintf(header, sizeof(header), "P5\n%d %d\n%d\n",
+                        img->width, img->height, img->max_val);
+    size_t total = (size_t)hlen + (size_t)img->width * img->height;
+    size_t padded = (total + 4095) & ~(size_t)4095;
+
+    unsigned char *buf = NULL;
+    if (posix_memalign((void **)&buf, 4096, padded) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    memcpy(buf, header, hlen);
+    memcpy(buf + hlen, img->data, (size_t)img->width * img->height);
+    memset(buf + total, 0, padded - total);
+
+    int rc = 0;
+    size_t written = 0;
+    while (written < padded)
+    {
+        ssize_t n = write(fd, buf + written, padded - written);
+        if (n <= 0)
+        {
+            rc = -1;
+            break;
+        }
+        written += (size_t)n;
+    }
+    if (rc == 0 && ftruncate(fd, (off_t)total) != 0)
+        rc = -1;
+    if (rc == 0 && write_fdatasync)
+        fdatasync(fd);
+    close(fd);
+    free(buf);
+    if (rc != 0)
+        fprintf(stderr, "Error: O_DIRECT write failed for %s\n", filename);
+    return rc;
+}
+
 static int save_pgm(const char *filename, Image *img)
 {
+    if (write_odirect)
+    {
+        int rc = save_pgm_direct(filename, img);
+        if (rc <= 0)
+            return rc;
+        /* rc > 0: filesystem rejected O_DIRECT; use the buffered path */
+    }
+
     FILE *file = fopen(filename, "wb");
     if (!file)
     {
@@ -81,67 +384,374 @@ static int save_pgm(const char *filename, Image *img)
     fprintf(file, "P5\n%d %d\n%d\n", img->width, img->height, img->max_val);
     fwrite(img->data, sizeof(unsigned char), img->width * img->height, file);
 
+    if (write_fdatasync)
+    {
+        fflush(file);
+        fdatasync(fileno(file));
+    }
     fclose(file);
     return 0;
 }
 
 /*
-If (x,y) is outside image boundaries, it clamps to the closest border coordinate. This is a common way to handle boundaries for convolution (avoids special casing edges).
+What are gx and gy?
+- gx is the discrete approximation of the derivative in the x (horizontal) direction.
+- gy is the derivative in the y (vertical) direction.
+They are computed by convolving the 3×3 neighborhood with the Sobel kernels.
 */
 
-static unsigned char get_pixel(const Image *img, int x, int y)
+/*
+Magnitude mode: exact is sqrt(gx^2 + gy^2); approx is |gx| + |gy|, which
+keeps the kernel in pure integer math. For consumers that threshold the
+result into a binary edge map the approx mode is a drop-in replacement
+(edges shift by at most the estimator error of ~1.4x on diagonals).
+*/
+typedef enum
+{
+    MAG_EXACT = 0,
+    MAG_APPROX = 1
+} MagMode;
+
+static MagMode mag_mode = MAG_EXACT;
+
+/*
+Scalar Sobel over columns [x0, x1) of one row. The three row pointers are
+already clamped in y by the caller; only x needs clamping here, which the
+caller restricts to the first/last column and the SIMD tail.
+*/
+static void sobel_row_scalar(const unsigned char *row_m1, const unsigned char *row_0,
+                             const unsigned char *row_p1, unsigned char *dst_row,
+                             int width, int x0, int x1)
 {
-    if (x < 0)
-        x = 0;
-    if (x >= img->width)
-        x = img->width - 1;
-    if (y < 0)
-        y = 0;
-    if (y >= img->height)
-        y = img->height - 1;
+    for (int x = x0; x < x1; x++)
+    {
+        int xm1 = (x == 0) ? 0 : x - 1;
+        int xp1 = (x == width - 1) ? width - 1 : x + 1;
+
+        int gx = -row_m1[xm1] + row_m1[xp1]
+                 - 2 * row_0[xm1] + 2 * row_0[xp1]
+                 - row_p1[xm1] + row_p1[xp1];
+        int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                 + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
 
-    return img->data[y * img->width + x];
+        int mag;
+        if (mag_mode == MAG_APPROX)
+            mag = abs(gx) + abs(gy);
+        else
+            mag = (int)sqrt((double)(gx * gx + gy * gy));
+        if (mag > 255)
+            mag = 255;
+        if (mag < 0)
+            mag = 0;
+        dst_row[x] = (unsigned char)mag;
+    }
 }
 
-static void set_pixel(Image *img, int x, int y, unsigned char value)
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/*
+SIMD Sobel for one row: processes interior columns 8 at a time with SSE2
+(present on every x86-64; -march=native in the Makefile picks the widest
+encoding available). gx/gy fit in 16-bit lanes (|g| <= 1020), the squared
+sums need 32-bit, and the sqrt runs on 4 floats at a time. The final
+packs/packus pair saturates the magnitude into 0..255 for free. Only the
+first/last column and the <8-pixel tail fall back to the scalar path.
+*/
+static void sobel_row_simd(const unsigned char *row_m1, const unsigned char *row_0,
+                           const unsigned char *row_p1, unsigned char *dst_row,
+                           int width)
 {
-    if (x >= 0 && x < img->width && y >= 0 && y < img->height)
+    if (width < 2)
     {
-        img->data[y * img->width + x] = value;
+        sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, 0, width);
+        return;
     }
+
+    /* Borders: x clamps only at the first and last column */
+    sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, 0, 1);
+    sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, width - 1, width);
+
+    const __m128i zero = _mm_setzero_si128();
+    int x = 1;
+    for (; x + 8 <= width - 1; x += 8)
+    {
+        /* Load the 3x3 neighborhood as 8 widened 16-bit pixels per tap */
+        __m128i p00 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x - 1)), zero);
+        __m128i p01 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x)), zero);
+        __m128i p02 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_m1 + x + 1)), zero);
+        __m128i p10 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_0 + x - 1)), zero);
+        __m128i p12 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_0 + x + 1)), zero);
+        __m128i p20 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x - 1)), zero);
+        __m128i p21 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x)), zero);
+        __m128i p22 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(row_p1 + x + 1)), zero);
+
+        /* gx = (p02 - p00) + 2*(p12 - p10) + (p22 - p20) */
+        __m128i gx = _mm_add_epi16(_mm_sub_epi16(p02, p00),
+                     _mm_add_epi16(_mm_slli_epi16(_mm_sub_epi16(p12, p10), 1),
+                                   _mm_sub_epi16(p22, p20)));
+        /* gy = (p20 + 2*p21 + p22) - (p00 + 2*p01 + p02) */
+        __m128i gy = _mm_sub_epi16(
+            _mm_add_epi16(_mm_add_epi16(p20, p22), _mm_slli_epi16(p21, 1)),
+            _mm_add_epi16(_mm_add_epi16(p00, p02), _mm_slli_epi16(p01, 1)));
+
+        __m128i mag16;
+        if (mag_mode == MAG_APPROX)
+        {
+            /* |gx| + |gy| stays in 16-bit lanes (max 2040); no SSSE3 abs,
+               so build it from max(g, -g) */
+            const __m128i zero16 = _mm_setzero_si128();
+            __m128i abs_gx = _mm_max_epi16(gx, _mm_sub_epi16(zero16, gx));
+            __m128i abs_gy = _mm_max_epi16(gy, _mm_sub_epi16(zero16, gy));
+            mag16 = _mm_add_epi16(abs_gx, abs_gy);
+        }
+        else
+        {
+            /* 32-bit gx*gx + gy*gy via mullo/mulhi interleave */
+            __m128i gx_lo = _mm_mullo_epi16(gx, gx);
+            __m128i gx_hi = _mm_mulhi_epi16(gx, gx);
+            __m128i gy_lo = _mm_mullo_epi16(gy, gy);
+            __m128i gy_hi = _mm_mulhi_epi16(gy, gy);
+            __m128i sq_lo = _mm_add_epi32(_mm_unpacklo_epi16(gx_lo, gx_hi),
+                                          _mm_unpacklo_epi16(gy_lo, gy_hi));
+            __m128i sq_hi = _mm_add_epi32(_mm_unpackhi_epi16(gx_lo, gx_hi),
+                                          _mm_unpackhi_epi16(gy_lo, gy_hi));
+
+            /* sqrt on 4 floats at a time, truncating like the scalar (int)sqrt */
+            __m128i mag_lo = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_lo)));
+            __m128i mag_hi = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(sq_hi)));
+            mag16 = _mm_packs_epi32(mag_lo, mag_hi);
+        }
+
+        /* Pack back to bytes; packus saturates anything above 255 */
+        __m128i mag8 = _mm_packus_epi16(mag16, mag16);
+        _mm_storel_epi64((__m128i *)(dst_row + x), mag8);
+    }
+
+    if (x < width - 1)
+        sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, x, width - 1);
 }
+#endif /* __SSE2__ */
 
 /*
-What are gx and gy?
-- gx is the discrete approximation of the derivative in the x (horizontal) direction.
-- gy is the derivative in the y (vertical) direction.
-They are computed by convolving the 3×3 neighborhood with the Sobel kernels.
+Generated kernels for the non-default pixel formats. Each instantiation
+bakes the pixel type, channel count, and output scale shift in as
+compile-time constants, so every variant keeps a tight monomorphic inner
+loop (the channel loop unrolls away) instead of branching on format per
+pixel. 16-bit gradients need 64-bit squares (|g| can reach 4*65535), and
+the magnitude is scaled by >> 8 so the 0..255 threshold keeps its
+meaning; RGB takes the max magnitude across channels, which catches
+edges that are invisible in the grayscale collapse (e.g. red/green
+boundaries of equal luma). The hand-written 8-bit SIMD kernel above
+stays the single-channel fast path.
 */
+#define DEFINE_SOBEL_ROW_KERNEL(NAME, PIXEL_T, CHANNELS, MAG_SHIFT)                               \
+static void NAME(const PIXEL_T *row_m1, const PIXEL_T *row_0, const PIXEL_T *row_p1,              \
+                 unsigned char *dst_row, int width)                                               \
+{                                                                                                 \
+    for (int x = 0; x < width; x++)                                                               \
+    {                                                                                             \
+        int xm1 = (x == 0) ? 0 : x - 1;                                                           \
+        int xp1 = (x == width - 1) ? width - 1 : x + 1;                                           \
+        long best = 0;                                                                            \
+        for (int c = 0; c < (CHANNELS); c++)                                                      \
+        {                                                                                         \
+            const PIXEL_T *m1 = row_m1 + c;                                                       \
+            const PIXEL_T *r0 = row_0 + c;                                                        \
+            const PIXEL_T *p1 = row_p1 + c;                                                       \
+            long gx = -(long)m1[xm1 * (CHANNELS)] + m1[xp1 * (CHANNELS)]                          \
+                      - 2L * r0[xm1 * (CHANNELS)] + 2L * r0[xp1 * (CHANNELS)]                     \
+                      - (long)p1[xm1 * (CHANNELS)] + p1[xp1 * (CHANNELS)];                        \
+            long gy = -(long)m1[xm1 * (CHANNELS)] - 2L * m1[x * (CHANNELS)] - m1[xp1 * (CHANNELS)] \
+                      + p1[xm1 * (CHANNELS)] + 2L * p1[x * (CHANNELS)] + p1[xp1 * (CHANNELS)];    \
+            long mag;                                                                             \
+            if (mag_mode == MAG_APPROX)                                                           \
+                mag = labs(gx) + labs(gy);                                                        \
+            else                                                                                  \
+                mag = (long)sqrt((double)(gx * gx + gy * gy));                                    \
+            mag >>= (MAG_SHIFT);                                                                  \
+            if (mag > best)                                                                       \
+                best = mag;                                                                       \
+        }                                                                                         \
+        dst_row[x] = (unsigned char)(best > 255 ? 255 : best);                                    \
+    }                                                                                             \
+}
+
+DEFINE_SOBEL_ROW_KERNEL(sobel_row_u16, uint16_t, 1, 8)
+DEFINE_SOBEL_ROW_KERNEL(sobel_row_rgb8, unsigned char, 3, 0)
 
 static void sobel_magnitude(const Image *input, Image *magnitude)
 {
+    size_t row_elems = (size_t)input->width * input->channels;
     for (int y = 0; y < input->height; y++)
     {
-        for (int x = 0; x < input->width; x++)
+        /* Clamp the row pointers once; pixel access below is branch-free in y */
+        size_t off_m1 = (size_t)((y == 0) ? 0 : y - 1) * row_elems;
+        size_t off_0 = (size_t)y * row_elems;
+        size_t off_p1 = (size_t)((y == input->height - 1) ? y : y + 1) * row_elems;
+        unsigned char *dst_row = magnitude->data + (size_t)y * input->width;
+
+        if (input->depth == 2)
+        {
+            const uint16_t *base = (const uint16_t *)input->data;
+            sobel_row_u16(base + off_m1, base + off_0, base + off_p1, dst_row, input->width);
+        }
+        else if (input->channels == 3)
+        {
+            sobel_row_rgb8(input->data + off_m1, input->data + off_0,
+                           input->data + off_p1, dst_row, input->width);
+        }
+        else
+        {
+#ifdef __SSE2__
+            sobel_row_simd(input->data + off_m1, input->data + off_0,
+                           input->data + off_p1, dst_row, input->width);
+#else
+            sobel_row_scalar(input->data + off_m1, input->data + off_0,
+                             input->data + off_p1, dst_row, input->width, 0, input->width);
+#endif
+        }
+    }
+}
+
+
+/*
+Separable convolution engine. Both Sobel gradients factor into a 1-pixel
+vertical pass and a horizontal pass (Gx = [1 2 1]^T x [-1 0 1], Gy the
+transpose), so each pixel's vertical sum is computed once and reused by
+the three horizontal taps of its neighbors -- nearly halving the adds of
+the direct 3x3 form. conv_separable() is the general engine (any odd tap
+count, integer kernels, power-of-two normalization) and also provides
+5x5 Gaussian pre-smoothing (--blur) that previously ran as a separate
+Python step. The hand-specialized 3x3 SIMD kernel above remains the
+default Sobel path -- the engine exists for kernel flexibility, the
+specialization for speed -- and --separable selects the engine form,
+which computes bit-identical gradients.
+*/
+
+static int conv_separable(const unsigned char *src, unsigned char *dst,
+                          int width, int height, const int *vk, const int *hk,
+                          int taps, int norm_shift)
+{
+    int radius = taps / 2;
+    int *vpass = (int *)malloc((size_t)width * sizeof(int));
+    if (!vpass)
+    {
+        fprintf(stderr, "Error: Out of memory in conv_separable\n");
+        return -1;
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            int acc = 0;
+            for (int t = 0; t < taps; t++)
+            {
+                int yy = y + t - radius;
+                if (yy < 0)
+                    yy = 0;
+                if (yy > height - 1)
+                    yy = height - 1;
+                acc += vk[t] * src[(size_t)yy * width + x];
+            }
+            vpass[x] = acc;
+        }
+        for (int x = 0; x < width; x++)
         {
-            int gx = 0;
-            int gy = 0;
+            int acc = 0;
+            for (int t = 0; t < taps; t++)
+            {
+                int xx = x + t - radius;
+                if (xx < 0)
+                    xx = 0;
+                if (xx > width - 1)
+                    xx = width - 1;
+                acc += hk[t] * vpass[xx];
+            }
+            acc >>= norm_shift;
+            if (acc < 0)
+                acc = 0;
+            if (acc > 255)
+                acc = 255;
+            dst[(size_t)y * width + x] = (unsigned char)acc;
+        }
+    }
+    free(vpass);
+    return 0;
+}
+
+/* 5x5 binomial approximation of a Gaussian; 16 * 16 = 256 -> shift 8 */
+static const int gauss5[5] = {1, 4, 6, 4, 1};
 
-            gx += -1 * get_pixel(input, x - 1, y - 1) + 1 * get_pixel(input, x + 1, y - 1);
-            gx += -2 * get_pixel(input, x - 1, y + 0) + 2 * get_pixel(input, x + 1, y + 0);
-            gx += -1 * get_pixel(input, x - 1, y + 1) + 1 * get_pixel(input, x + 1, y + 1);
+/* Returns a blurred copy (inputs may be read-only mmap'd PGMs) */
+static Image *apply_gaussian_blur(const Image *input)
+{
+    Image *blurred = create_image(input->width, input->height, input->max_val);
+    if (!blurred)
+        return NULL;
+    if (conv_separable(input->data, blurred->data, input->width, input->height,
+                       gauss5, gauss5, 5, 8) != 0)
+    {
+        free_image(blurred);
+        return NULL;
+    }
+    return blurred;
+}
+
+/*
+Sobel via the separable factorization: one vertical pass per row produces
+the [1 2 1] smooth (for gx) and the [-1 0 1] difference (for gy), and the
+horizontal pass combines three of each. Same clamping and magnitude math
+as the direct kernel, so the output is bit-identical.
+*/
+static int sobel_separable(const Image *input, Image *magnitude)
+{
+    int width = input->width;
+    int *vsum = (int *)malloc((size_t)width * sizeof(int));
+    int *vdiff = (int *)malloc((size_t)width * sizeof(int));
+    if (!vsum || !vdiff)
+    {
+        fprintf(stderr, "Error: Out of memory in sobel_separable\n");
+        free(vsum);
+        free(vdiff);
+        return -1;
+    }
+
+    for (int y = 0; y < input->height; y++)
+    {
+        const unsigned char *row_m1 = input->data + (size_t)((y == 0) ? 0 : y - 1) * width;
+        const unsigned char *row_0 = input->data + (size_t)y * width;
+        const unsigned char *row_p1 = input->data + (size_t)((y == input->height - 1) ? y : y + 1) * width;
+        unsigned char *dst_row = magnitude->data + (size_t)y * width;
 
-            gy += -1 * get_pixel(input, x - 1, y - 1) + -2 * get_pixel(input, x + 0, y - 1) + -1 * get_pixel(input, x + 1, y - 1);
-            gy += 1 * get_pixel(input, x - 1, y + 1) + 2 * get_pixel(input, x + 0, y + 1) + 1 * get_pixel(input, x + 1, y + 1);
+        for (int x = 0; x < width; x++)
+        {
+            vsum[x] = row_m1[x] + 2 * row_0[x] + row_p1[x];
+            vdiff[x] = row_p1[x] - row_m1[x];
+        }
+        for (int x = 0; x < width; x++)
+        {
+            int xm1 = (x == 0) ? 0 : x - 1;
+            int xp1 = (x == width - 1) ? width - 1 : x + 1;
+            int gx = vsum[xp1] - vsum[xm1];
+            int gy = vdiff[xm1] + 2 * vdiff[x] + vdiff[xp1];
 
-            int mag = (int)sqrt((double)(gx * gx + gy * gy));
+            int mag;
+            if (mag_mode == MAG_APPROX)
+                mag = abs(gx) + abs(gy);
+            else
+                mag = (int)sqrt((double)(gx * gx + gy * gy));
             if (mag > 255)
                 mag = 255;
             if (mag < 0)
                 mag = 0;
-            set_pixel(magnitude, x, y, (unsigned char)mag);
+            dst_row[x] = (unsigned char)mag;
         }
     }
+    free(vsum);
+    free(vdiff);
+    return 0;
 }
 
 /*
@@ -159,12 +769,532 @@ static void threshold_image(const Image *src, Image *dst, unsigned char threshol
     }
 }
 
+
+
+/*
+Phase-level instrumentation. Every binary reports the same four phases
+(decode, sobel, threshold, encode) as wall-clock seconds plus effective
+MPix/s, and --csv=<file> appends one row per phase in the schema that
+phase3/metrics.csv and phase3/performance/run_analysis.py already use
+(timestamp,latency,status,server), with server = "<binary>:<phase>".
+*/
+static const char *metrics_csv_path = NULL;
+
+static double now_seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void metrics_log_phase(const char *binary, const char *phase, double seconds)
+{
+    if (!metrics_csv_path)
+        return;
+    FILE *file = fopen(metrics_csv_path, "a");
+    if (!file)
+        return;
+    if (ftell(file) == 0)
+        fprintf(file, "timestamp,latency,status,server\n");
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fprintf(file, "%.6f,%f,SUCCESS,%s:%s\n",
+            ts.tv_sec + ts.tv_nsec * 1e-9, seconds, binary, phase);
+    fclose(file);
+}
+
+static void report_phases(const char *binary, int width, int height,
+                          double decode_s, double sobel_s, double threshold_s,
+                          double encode_s)
+{
+    double mpix = (double)width * height / 1e6;
+    double total = decode_s + sobel_s + threshold_s + encode_s;
+    printf("Phase timings: decode=%.6f sobel=%.6f threshold=%.6f encode=%.6f total=%.6f s\n",
+           decode_s, sobel_s, threshold_s, encode_s, total);
+    printf("Processed %.2f MPix (%zu bytes) at %.1f MPix/s (sobel phase), %.1f MPix/s end-to-end\n",
+           mpix, (size_t)width * height,
+           sobel_s > 0 ? mpix / sobel_s : 0.0, total > 0 ? mpix / total : 0.0);
+    metrics_log_phase(binary, "decode", decode_s);
+    metrics_log_phase(binary, "sobel", sobel_s);
+    metrics_log_phase(binary, "threshold", threshold_s);
+    metrics_log_phase(binary, "encode", encode_s);
+    metrics_log_phase(binary, "total", total);
+}
+
+/*
+Batch mode: take a directory (or a text file listing one path per line)
+and process every image in one launch, so process startup and teardown is
+paid once instead of per frame.
+*/
+
+static bool has_image_extension(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot)
+        return false;
+    return strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0 ||
+           strcasecmp(dot, ".png") == 0 || strcasecmp(dot, ".pgm") == 0 ||
+           strcasecmp(dot, ".bmp") == 0;
+}
+
+/*
+Build the list of input paths: a directory is scanned for image files, a
+regular file is read as one path per line. Returns a malloc'd array of
+malloc'd strings (caller frees) and sets *count.
+*/
+static char **collect_inputs(const char *arg, int *count)
+{
+    char **paths = NULL;
+    int n = 0, cap = 0;
+
+    struct stat st;
+    if (stat(arg, &st) != 0)
+    {
+        fprintf(stderr, "Error: Cannot stat %s\n", arg);
+        return NULL;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(arg);
+        if (!dir)
+        {
+            fprintf(stderr, "Error: Cannot open directory %s\n", arg);
+            return NULL;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (!has_image_extension(entry->d_name))
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                paths = (char **)realloc(paths, cap * sizeof(char *));
+            }
+            char *full = (char *)malloc(MAX_PATH * 2);
+            snprintf(full, MAX_PATH * 2, "%s/%s", arg, entry->d_name);
+            paths[n++] = full;
+        }
+        closedir(dir);
+    }
+    else
+    {
+        FILE *file = fopen(arg, "r");
+        if (!file)
+        {
+            fprintf(stderr, "Error: Cannot open list file %s\n", arg);
+            return NULL;
+        }
+        char line[MAX_PATH];
+        while (fgets(line, sizeof(line), file))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                paths = (char **)realloc(paths, cap * sizeof(char *));
+            }
+            paths[n++] = strdup(line);
+        }
+        fclose(file);
+    }
+
+    *count = n;
+    return paths;
+}
+
+/* output path: <outdir>/<input basename>.pgm */
+static void make_output_path(char *dst, size_t dst_size, const char *outdir, const char *in_path)
+{
+    const char *base = strrchr(in_path, '/');
+    base = base ? base + 1 : in_path;
+    const char *dot = strrchr(base, '.');
+    int stem_len = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(dst, dst_size, "%s/%.*s.pgm", outdir, stem_len, base);
+}
+
+/*
+Async writer for batch mode: compute hands each finished frame to a
+single writer thread through a one-slot mailbox and immediately starts
+the next frame in a fresh buffer (the arena recycles the one the writer
+releases, so steady state is two output buffers ping-ponging). With the
+kernel finishing in single-digit milliseconds and NFS writes costing
+tens, this overlaps essentially all output I/O with compute.
+*/
+typedef struct
+{
+    char out_path[MAX_PATH];
+    Image *img;
+} WriteJob;
+
+typedef struct
+{
+    WriteJob job;
+    int full;
+    int done;
+    int written; /* frames saved successfully */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} AsyncWriter;
+
+static void *pgm_writer_thread(void *arg)
+{
+    AsyncWriter *writer = (AsyncWriter *)arg;
+    pthread_mutex_lock(&writer->lock);
+    for (;;)
+    {
+        while (!writer->full && !writer->done)
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        if (!writer->full)
+            break; /* done and drained */
+        WriteJob job = writer->job;
+        writer->full = 0;
+        pthread_cond_signal(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+
+        int ok = (save_pgm(job.out_path, job.img) == 0);
+        free_image(job.img);
+
+        pthread_mutex_lock(&writer->lock);
+        if (ok)
+            writer->written++;
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/* Blocks only if the writer still holds the previous frame */
+static void writer_submit(AsyncWriter *writer, const char *out_path, Image *img)
+{
+    pthread_mutex_lock(&writer->lock);
+    while (writer->full)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    snprintf(writer->job.out_path, sizeof(writer->job.out_path), "%s", out_path);
+    writer->job.img = img;
+    writer->full = 1;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+static int run_batch(const char *input_arg, const char *outdir, unsigned char threshold)
+{
+    int count = 0;
+    char **paths = collect_inputs(input_arg, &count);
+    if (!paths || count == 0)
+    {
+        fprintf(stderr, "Error: No input images found in %s\n", input_arg);
+        free(paths);
+        return 1;
+    }
+
+    /* One big region up front; per-frame buffers recycle out of it */
+    image_arena_init((size_t)512 * 1024 * 1024);
+
+    printf("Batch mode: %d images, output dir %s\n", count, outdir);
+
+    AsyncWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    pthread_mutex_init(&writer.lock, NULL);
+    pthread_cond_init(&writer.cond, NULL);
+    pthread_t writer_tid;
+    pthread_create(&writer_tid, NULL, pgm_writer_thread, &writer);
+
+    double batch_start = now_seconds();
+    for (int i = 0; i < count; i++)
+    {
+        Image *input = load_image(paths[i]);
+        if (!input)
+            continue;
+        Image *mag = create_image(input->width, input->height, 255);
+        Image *out = create_image(input->width, input->height, 255);
+        if (!mag || !out)
+        {
+            fprintf(stderr, "Error: Out of memory\n");
+            free_image(mag);
+            free_image(out);
+            free_image(input);
+            continue;
+        }
+        sobel_magnitude(input, mag);
+        threshold_image(mag, out, threshold);
+
+        char out_path[MAX_PATH];
+        make_output_path(out_path, sizeof(out_path), outdir, paths[i]);
+        /* Ownership of out moves to the writer; the next frame's
+           create_image() picks up a fresh (or recycled) buffer */
+        writer_submit(&writer, out_path, out);
+        free_image(mag);
+        free_image(input);
+    }
+
+    pthread_mutex_lock(&writer.lock);
+    writer.done = 1;
+    pthread_cond_broadcast(&writer.cond);
+    pthread_mutex_unlock(&writer.lock);
+    pthread_join(writer_tid, NULL);
+
+    int processed = writer.written;
+    double batch_time = now_seconds() - batch_start;
+    printf("Processed %d/%d images in %.3f seconds (%.1f images/s)\n",
+           processed, count, batch_time, processed / (batch_time > 0 ? batch_time : 1));
+
+    for (int i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+    return processed == count ? 0 : 1;
+}
+
+/*
+Streaming mode (--stream): processes a binary PGM through a rolling
+three-row window instead of materializing the frame, so memory use is
+four row buffers no matter how many rows the image has -- a 100k x 100k
+(10 GB) frame streams through a few hundred KB. The Sobel stencil only
+ever needs rows y-1..y+1, so each output row is computed, thresholded and
+written as soon as the row below it has been read. Only P5 input works
+here (anything else needs a full decode, which defeats the point).
+*/
+
+static int read_pgm_stream_header(FILE *file, int *width, int *height, int *max_val)
+{
+    if (fgetc(file) != 'P' || fgetc(file) != '5')
+        return -1;
+    int fields[3];
+    for (int i = 0; i < 3; i++)
+    {
+        int c = fgetc(file);
+        while (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#')
+        {
+            if (c == '#')
+                while (c != EOF && c != '\n')
+                    c = fgetc(file);
+            c = fgetc(file);
+        }
+        if (c < '0' || c > '9')
+            return -1;
+        int value = 0;
+        while (c >= '0' && c <= '9')
+        {
+            value = value * 10 + (c - '0');
+            c = fgetc(file); /* the final iteration eats the single whitespace
+                                byte separating this field from the next */
+        }
+        fields[i] = value;
+    }
+    *width = fields[0];
+    *height = fields[1];
+    *max_val = fields[2];
+    return (*width > 0 && *height > 0 && *max_val > 0 && *max_val <= 255) ? 0 : -1;
+}
+
+static int run_stream(const char *in_path, const char *out_path, unsigned char threshold)
+{
+    FILE *in = fopen(in_path, "rb");
+    if (!in)
+    {
+        fprintf(stderr, "Error: Cannot open %s\n", in_path);
+        return 1;
+    }
+    int width, height, max_val;
+    if (read_pgm_stream_header(in, &width, &height, &max_val) != 0)
+    {
+        fprintf(stderr, "Error: --stream requires a binary PGM (P5) input\n");
+        fclose(in);
+        return 1;
+    }
+    FILE *out = fopen(out_path, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Error: Cannot create file %s\n", out_path);
+        fclose(in);
+        return 1;
+    }
+    fprintf(out, "P5\n%d %d\n255\n", width, height);
+
+    /* Three rotating input rows plus one output row: bufs[y % 3] always
+       holds row y, and row y+2 is read just before moving to row y+1 */
+    unsigned char *bufs[3], *dst_row;
+    for (int i = 0; i < 3; i++)
+        bufs[i] = (unsigned char *)malloc((size_t)width);
+    dst_row = (unsigned char *)malloc((size_t)width);
+    if (!bufs[0] || !bufs[1] || !bufs[2] || !dst_row)
+    {
+        fprintf(stderr, "Error: Out of memory\n");
+        fclose(in);
+        fclose(out);
+        return 1;
+    }
+
+    printf("Streaming %dx%d (%zu bytes) through a 3-row window\n",
+           width, height, (size_t)width * height);
+
+    double read_s = 0.0, compute_s = 0.0, write_s = 0.0, t0;
+    int rc = 0;
+
+    t0 = now_seconds();
+    if (fread(bufs[0], 1, width, in) != (size_t)width ||
+        (height > 1 && fread(bufs[1], 1, width, in) != (size_t)width))
+    {
+        fprintf(stderr, "Error: Truncated input %s\n", in_path);
+        rc = 1;
+        height = 0; /* skip the loop, fall through to cleanup */
+    }
+    read_s += now_seconds() - t0;
+
+    for (int y = 0; y < height; y++)
+    {
+        /* Same y-clamping as sobel_magnitude(), via buffer choice */
+        const unsigned char *row_m1 = bufs[((y == 0) ? 0 : y - 1) % 3];
+        const unsigned char *row_0 = bufs[y % 3];
+        const unsigned char *row_p1 = bufs[((y == height - 1) ? y : y + 1) % 3];
+
+        t0 = now_seconds();
+#ifdef __SSE2__
+        sobel_row_simd(row_m1, row_0, row_p1, dst_row, width);
+#else
+        sobel_row_scalar(row_m1, row_0, row_p1, dst_row, width, 0, width);
+#endif
+        for (int x = 0; x < width; x++)
+            dst_row[x] = (dst_row[x] >= threshold) ? 255 : 0;
+        compute_s += now_seconds() - t0;
+
+        t0 = now_seconds();
+        if (fwrite(dst_row, 1, width, out) != (size_t)width)
+        {
+            fprintf(stderr, "Error: Short write to %s\n", out_path);
+            rc = 1;
+            break;
+        }
+        write_s += now_seconds() - t0;
+
+        if (y + 2 < height)
+        {
+            t0 = now_seconds();
+            if (fread(bufs[(y + 2) % 3], 1, width, in) != (size_t)width)
+            {
+                fprintf(stderr, "Error: Truncated input %s\n", in_path);
+                rc = 1;
+                break;
+            }
+            read_s += now_seconds() - t0;
+        }
+    }
+
+    fclose(in);
+    fclose(out);
+    if (rc == 0)
+        report_phases("sobel_seq", width, height, read_s, compute_s, 0.0, write_s);
+    for (int i = 0; i < 3; i++)
+        free(bufs[i]);
+    free(dst_row);
+    return rc;
+}
+
 int main(int argc, char *argv[])
 {
+    bool stream_mode = false;
+    bool separable_mode = false;
+    bool blur_mode = false;
+
+    /* Strip option flags before positional argument handling */
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--approx") == 0)
+        {
+            mag_mode = MAG_APPROX;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strncmp(argv[i], "--csv=", 6) == 0)
+        {
+            metrics_csv_path = argv[i] + 6;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--separable") == 0)
+        {
+            separable_mode = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--blur") == 0)
+        {
+            blur_mode = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--rgb") == 0)
+        {
+            rgb_mode = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--odirect") == 0)
+        {
+            write_odirect = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--fdatasync") == 0)
+        {
+            write_fdatasync = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--stream") == 0)
+        {
+            stream_mode = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "--batch") == 0)
+    {
+        unsigned char threshold = 100;
+        if (argc >= 5)
+        {
+            int t = atoi(argv[4]);
+            if (t < 0)
+                t = 0;
+            if (t > 255)
+                t = 255;
+            threshold = (unsigned char)t;
+        }
+        return run_batch(argv[2], argv[3], threshold);
+    }
+
     if (argc < 3)
     {
         fprintf(stderr, "Usage: %s <input_image> <output_image.pgm> [threshold]\n", argv[0]);
+        fprintf(stderr, "       %s --batch <input_dir|list.txt> <output_dir> [threshold]\n", argv[0]);
         fprintf(stderr, "  threshold: Edge detection threshold (default: 100)\n");
+        fprintf(stderr, "  --approx:  Integer |gx|+|gy| magnitude (no per-pixel sqrt)\n");
+        fprintf(stderr, "  --csv=FILE: Append per-phase timings in the phase3 metrics.csv schema\n");
+        fprintf(stderr, "  --stream:  Rolling 3-row window for PGM inputs larger than RAM\n");
+        fprintf(stderr, "  --separable: Sobel via the separable convolution engine\n");
+        fprintf(stderr, "  --blur:    5x5 Gaussian pre-smoothing before the gradient\n");
+        fprintf(stderr, "  --rgb:     Process color inputs as 3 channels (max magnitude)\n");
+        fprintf(stderr, "  --odirect: Write output with O_DIRECT (bypass the page cache)\n");
+        fprintf(stderr, "  --fdatasync: fdatasync each output before continuing\n");
         return 1;
     }
 
@@ -179,42 +1309,76 @@ int main(int argc, char *argv[])
         threshold = (unsigned char)t;
     }
 
+    if (stream_mode)
+        return run_stream(argv[1], argv[2], threshold);
+
     printf("Loading image: %s\n", argv[1]);
+    double t0 = now_seconds();
     Image *input = load_image(argv[1]);
+    double decode_s = now_seconds() - t0;
     if (!input)
     {
         return 1;
     }
     printf("Image loaded: %dx%d\n", input->width, input->height);
 
+    if ((blur_mode || separable_mode) && (input->depth != 1 || input->channels != 1))
+    {
+        fprintf(stderr, "Warning: --blur/--separable support 8-bit grayscale only; ignoring\n");
+        blur_mode = separable_mode = false;
+    }
+
+    if (blur_mode)
+    {
+        double tb = now_seconds();
+        Image *blurred = apply_gaussian_blur(input);
+        if (!blurred)
+        {
+            free_image(input);
+            fprintf(stderr, "Error: Out of memory\n");
+            return 1;
+        }
+        free_image(input);
+        input = blurred;
+        printf("Gaussian 5x5 pre-smoothing: %.6f seconds\n", now_seconds() - tb);
+    }
+
+    /* Allocate both buffers before starting any timer, so the phase
+       numbers measure the pipeline and nothing else */
     Image *mag = create_image(input->width, input->height, 255);
-    if (!mag)
+    Image *out = create_image(input->width, input->height, 255);
+    if (!mag || !out)
     {
+        free_image(mag);
+        free_image(out);
         free_image(input);
         fprintf(stderr, "Error: Out of memory\n");
         return 1;
     }
-    clock_t start, end;
-    double cpu_time_used;
-    start = clock();
-
-    sobel_magnitude(input, mag);
 
-    Image *out = create_image(input->width, input->height, 255);
-    if (!out)
+    t0 = now_seconds();
+    if (separable_mode && sobel_separable(input, mag) != 0)
     {
         free_image(mag);
+        free_image(out);
         free_image(input);
-        fprintf(stderr, "Error: Out of memory\n");
         return 1;
     }
-    end = clock();
-    cpu_time_used = ((double)(end-start)) / CLOCKS_PER_SEC;
+    if (!separable_mode)
+        sobel_magnitude(input, mag);
+    double sobel_s = now_seconds() - t0;
 
-    printf("sequential runtime: %.6f seconds\n", cpu_time_used);
+    t0 = now_seconds();
+    threshold_image(mag, out, threshold);
+    double threshold_s = now_seconds() - t0;
+
+    printf("sequential runtime: %.6f seconds\n", sobel_s + threshold_s);
 
     printf("Saving output image: %s\n", argv[2]);
-    if (save_pgm(argv[2], out) != 0)
+    t0 = now_seconds();
+    int save_rc = save_pgm(argv[2], out);
+    double encode_s = now_seconds() - t0;
+    if (save_rc != 0)
     {
         free_image(out);
         free_image(mag);
@@ -222,6 +1386,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    report_phases("sobel_seq", input->width, input->height,
+                  decode_s, sobel_s, threshold_s, encode_s);
+
     free_image(out);
     free_image(mag);
     free_image(input);
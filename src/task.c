@@ -4,12 +4,34 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <time.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #define MAX_PATH 256
-#define TILE_SIZE 64  
+#define TILE_SIZE 64 /* default tile edge; see tile_w/tile_h below */
+
+/*
+Tile shape is a runtime knob now: the right shape depends on L1/L2 size
+and image width (wide-short tiles keep the three input rows resident for
+large widths, squares win for small frames). --tile WxH sets it
+explicitly; --autotune sweeps a few shapes on the actual input and keeps
+the winner, caching the result per image size in .nexus_tile_cache so
+later runs on the same machine skip the sweep.
+*/
+static int tile_w = TILE_SIZE;
+static int tile_h = TILE_SIZE;
+static bool tile_autotune = false;
+
+#define TILE_CACHE_FILE ".nexus_tile_cache"
+
 
 typedef struct
 {
@@ -17,8 +39,97 @@ typedef struct
     int height;
     int max_val;
     unsigned char *data;
+    void *map_base;  /* non-NULL when data points into an mmap'd PGM file */
+    size_t map_len;
 } Image;
 
+
+/*
+Arena allocator: steady-state batch and server workloads allocate and
+free the same two or three multi-megabyte frame buffers over and over,
+which hammers the allocator and bounces pages back to the kernel between
+frames. image_arena_init() reserves one large anonymous mapping up front
+(hinted to use huge pages) and create_image() recycles fixed blocks out
+of it, so after the first frame there are zero mallocs and zero new page
+faults. Anything that does not fit falls back to plain malloc.
+*/
+
+#define ARENA_MAX_BLOCKS 16
+
+typedef struct
+{
+    unsigned char *ptr;
+    size_t size;
+    int in_use;
+} ArenaBlock;
+
+static unsigned char *arena_base = NULL;
+static size_t arena_size = 0;
+static size_t arena_used = 0;
+static ArenaBlock arena_blocks[ARENA_MAX_BLOCKS];
+static int arena_block_count = 0;
+
+static int image_arena_init(size_t bytes)
+{
+    void *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return -1;
+#ifdef MADV_HUGEPAGE
+    madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+    arena_base = (unsigned char *)base;
+    arena_size = bytes;
+    arena_used = 0;
+    arena_block_count = 0;
+    return 0;
+}
+
+static unsigned char *arena_alloc(size_t size)
+{
+    if (!arena_base)
+        return NULL;
+    size = (size + 63) & ~(size_t)63; /* keep blocks cacheline aligned */
+
+    unsigned char *result = NULL;
+    /* Recycle a free block of the same size first (the steady-state hit) */
+    for (int i = 0; i < arena_block_count; i++)
+    {
+        if (!arena_blocks[i].in_use && arena_blocks[i].size == size)
+        {
+            arena_blocks[i].in_use = 1;
+            result = arena_blocks[i].ptr;
+            break;
+        }
+    }
+    if (!result && arena_block_count < ARENA_MAX_BLOCKS && arena_used + size <= arena_size)
+    {
+        ArenaBlock *block = &arena_blocks[arena_block_count++];
+        block->ptr = arena_base + arena_used;
+        block->size = size;
+        block->in_use = 1;
+        arena_used += size;
+        result = block->ptr;
+    }
+    return result;
+}
+
+/* Returns 1 if ptr belonged to the arena (and is now recycled), 0 otherwise */
+static int arena_release(unsigned char *ptr)
+{
+    if (!arena_base || ptr < arena_base || ptr >= arena_base + arena_size)
+        return 0;
+    for (int i = 0; i < arena_block_count; i++)
+    {
+        if (arena_blocks[i].ptr == ptr)
+        {
+            arena_blocks[i].in_use = 0;
+            break;
+        }
+    }
+    return 1;
+}
+
 static Image *create_image(int width, int height, int max_val)
 {
     Image *img = (Image *)malloc(sizeof(Image));
@@ -27,7 +138,11 @@ static Image *create_image(int width, int height, int max_val)
     img->width = width;
     img->height = height;
     img->max_val = max_val;
-    img->data = (unsigned char *)malloc((size_t)width * (size_t)height);
+    img->map_base = NULL;
+    img->map_len = 0;
+    img->data = arena_alloc((size_t)width * (size_t)height);
+    if (!img->data)
+        img->data = (unsigned char *)malloc((size_t)width * (size_t)height);
     if (!img->data)
     {
         free(img);
@@ -40,12 +155,104 @@ static void free_image(Image *img)
 {
     if (!img)
         return;
-    free(img->data);
+    if (img->map_base)
+        munmap(img->map_base, img->map_len);
+    else if (!arena_release(img->data))
+        free(img->data);
     free(img);
 }
 
+
+/*
+Native P5/PGM fast path: mmap() the file and point Image.data straight at
+the mapped pixel bytes -- no decode, no copy, no pixel allocation. Most
+pipeline inputs are 8-bit PGM produced upstream by convert_to_pgm.py, so
+this skips stb entirely for them; anything else (JPEG/PNG/...) still goes
+through stbi_load() below.
+*/
+static Image *load_pgm_mmap(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 10)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping keeps the file open */
+    if (base == MAP_FAILED)
+        return NULL;
+
+    const char *p = (const char *)base;
+    const char *end = p + st.st_size;
+
+    if (p[0] != 'P' || p[1] != '5')
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    p += 2;
+
+    /* Parse width, height, maxval; whitespace and # comments may separate them */
+    int fields[3];
+    for (int i = 0; i < 3; i++)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '#'))
+        {
+            if (*p == '#')
+                while (p < end && *p != '\n')
+                    p++;
+            else
+                p++;
+        }
+        int value = 0;
+        if (p >= end || *p < '0' || *p > '9')
+        {
+            munmap(base, (size_t)st.st_size);
+            return NULL;
+        }
+        while (p < end && *p >= '0' && *p <= '9')
+            value = value * 10 + (*p++ - '0');
+        fields[i] = value;
+    }
+    p++; /* exactly one whitespace byte separates maxval from pixel data */
+
+    int width = fields[0], height = fields[1], max_val = fields[2];
+    if (width <= 0 || height <= 0 || max_val <= 0 || max_val > 255 ||
+        end - p < (long)((size_t)width * height))
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+
+    Image *img = (Image *)malloc(sizeof(Image));
+    if (!img)
+    {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    img->width = width;
+    img->height = height;
+    img->max_val = max_val;
+    img->map_base = base;
+    img->map_len = (size_t)st.st_size;
+    img->data = (unsigned char *)p; /* zero-copy: points into the mapping */
+    return img;
+}
+
+
 static Image *load_image(const char *filename)
 {
+    /* 8-bit PGM inputs map straight from disk; everything else decodes via stb */
+    Image *mapped = load_pgm_mmap(filename);
+    if (mapped)
+        return mapped;
+
     int width, height, channels;
     unsigned char *data = stbi_load(filename, &width, &height, &channels, 1); // Force 1 channel (grayscale)
 
@@ -86,74 +293,206 @@ static int save_pgm(const char *filename, Image *img)
 }
 
 /*
-If (x,y) is outside image boundaries, it clamps to the closest border coordinate.
+Magnitude mode: exact is sqrt(gx^2 + gy^2); approx is |gx| + |gy|, which
+keeps the kernel in pure integer math. For consumers that threshold the
+result into a binary edge map the approx mode is a drop-in replacement
+(edges shift by at most the estimator error of ~1.4x on diagonals).
 */
-static unsigned char get_pixel(const Image *img, int x, int y)
-{
-    if (x < 0)
-        x = 0;
-    if (x >= img->width)
-        x = img->width - 1;
-    if (y < 0)
-        y = 0;
-    if (y >= img->height)
-        y = img->height - 1;
-
-    return img->data[y * img->width + x];
-}
+typedef enum
+{
+    MAG_EXACT = 0,
+    MAG_APPROX = 1
+} MagMode;
+
+static MagMode mag_mode = MAG_EXACT;
 
-static void set_pixel(Image *img, int x, int y, unsigned char value)
+/*
+Scalar Sobel over columns [x0, x1) of one row. The three row pointers are
+already clamped in y by the caller; only x needs clamping here, so the
+four-way get_pixel() branch and the y*width+x index disappear from the
+interior of each tile.
+*/
+static void sobel_row_scalar(const unsigned char *row_m1, const unsigned char *row_0,
+                             const unsigned char *row_p1, unsigned char *dst_row,
+                             int width, int x0, int x1)
 {
-    if (x >= 0 && x < img->width && y >= 0 && y < img->height)
+    for (int x = x0; x < x1; x++)
     {
-        img->data[y * img->width + x] = value;
+        int xm1 = (x == 0) ? 0 : x - 1;
+        int xp1 = (x == width - 1) ? width - 1 : x + 1;
+
+        int gx = -row_m1[xm1] + row_m1[xp1]
+                 - 2 * row_0[xm1] + 2 * row_0[xp1]
+                 - row_p1[xm1] + row_p1[xp1];
+        int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                 + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+
+        int mag;
+        if (mag_mode == MAG_APPROX)
+            mag = abs(gx) + abs(gy);
+        else
+            mag = (int)sqrt((double)(gx * gx + gy * gy));
+        if (mag > 255)
+            mag = 255;
+        if (mag < 0)
+            mag = 0;
+        dst_row[x] = (unsigned char)mag;
     }
 }
 
-static void sobel_tile(const Image *input, Image *magnitude, 
+static void sobel_tile(const Image *input, Image *magnitude,
                        int start_y, int end_y, int start_x, int end_x)
 {
     for (int y = start_y; y < end_y; y++)
     {
-        for (int x = start_x; x < end_x; x++)
+        /* Clamp the three source rows once per row instead of per pixel */
+        const unsigned char *row_m1 = input->data + (size_t)((y == 0) ? 0 : y - 1) * input->width;
+        const unsigned char *row_0 = input->data + (size_t)y * input->width;
+        const unsigned char *row_p1 = input->data + (size_t)((y == input->height - 1) ? y : y + 1) * input->width;
+        unsigned char *dst_row = magnitude->data + (size_t)y * input->width;
+
+        sobel_row_scalar(row_m1, row_0, row_p1, dst_row, input->width, start_x, end_x);
+    }
+}
+
+/*
+Work-stealing tile scheduler. The OpenMP task decomposition below leaves
+the runtime free to run tiles anywhere, and with static-ish placement a
+straggler core leaves the rest idle at the tail. Here every thread owns a
+deque seeded with a contiguous row-major run of tile indices, so in the
+common case each thread sweeps its own rows front-to-back and the halo
+rows stay resident in its cache; a thread that drains its deque steals
+one tile at a time from the FAR end of a victim's deque -- the tiles the
+victim would touch last and has not warmed yet -- so locality holds where
+it matters and only the tail self-balances. Deques are [head, tail)
+ranges over the implicit row-major tile order guarded by a per-deque
+lock; at 64x64 tiles the lock is a few ns against ~10 us of kernel work,
+so a lock-free deque would buy nothing. When a full scan of every deque
+finds nothing, all tiles are taken and the thread is done.
+*/
+static void sobel_threshold_tile(const Image *input, Image *out,
+                                 int start_y, int end_y, int start_x, int end_x,
+                                 int threshold);
+
+typedef struct
+{
+    int head, tail; /* remaining tiles: indices [head, tail) in row-major order */
+    omp_lock_t lock;
+} TileDeque;
+
+typedef struct
+{
+    const Image *input;
+    Image *out;
+    int threshold;
+    bool fused; /* fused sobel+threshold vs raw magnitude */
+} TileJob;
+
+static bool steal_mode = true; /* --omp-tasks restores the OpenMP task scheduler */
+
+static void run_tile_index(const TileJob *job, int index, int tiles_x)
+{
+    int tile_y = (index / tiles_x) * tile_h;
+    int tile_x = (index % tiles_x) * tile_w;
+    int end_y = (tile_y + tile_h < job->input->height) ? tile_y + tile_h : job->input->height;
+    int end_x = (tile_x + tile_w < job->input->width) ? tile_x + tile_w : job->input->width;
+    if (job->fused)
+        sobel_threshold_tile(job->input, job->out, tile_y, end_y, tile_x, end_x,
+                             job->threshold);
+    else
+        sobel_tile(job->input, job->out, tile_y, end_y, tile_x, end_x);
+}
+
+static void process_tiles_stealing(const TileJob *job)
+{
+    int tiles_x = (job->input->width + tile_w - 1) / tile_w;
+    int tiles_y = (job->input->height + tile_h - 1) / tile_h;
+    int num_tiles = tiles_x * tiles_y;
+
+    int num_threads = omp_get_max_threads();
+    if (num_threads > num_tiles)
+        num_threads = num_tiles;
+
+    TileDeque *deques = (TileDeque *)malloc((size_t)num_threads * sizeof(TileDeque));
+    int base = num_tiles / num_threads;
+    int rem = num_tiles % num_threads;
+    for (int t = 0; t < num_threads; t++)
+    {
+        deques[t].head = t * base + (t < rem ? t : rem);
+        deques[t].tail = deques[t].head + base + (t < rem ? 1 : 0);
+        omp_init_lock(&deques[t].lock);
+    }
+
+    int steals = 0;
+
+    #pragma omp parallel num_threads(num_threads) reduction(+ : steals)
+    {
+        int tid = omp_get_thread_num();
+        for (;;)
         {
-            int gx = 0;
-            int gy = 0;
-
-            gx += -1 * get_pixel(input, x - 1, y - 1) + 1 * get_pixel(input, x + 1, y - 1);
-            gx += -2 * get_pixel(input, x - 1, y + 0) + 2 * get_pixel(input, x + 1, y + 0);
-            gx += -1 * get_pixel(input, x - 1, y + 1) + 1 * get_pixel(input, x + 1, y + 1);
-
-            gy += -1 * get_pixel(input, x - 1, y - 1) + -2 * get_pixel(input, x + 0, y - 1) + -1 * get_pixel(input, x + 1, y - 1);
-            gy += 1 * get_pixel(input, x - 1, y + 1) + 2 * get_pixel(input, x + 0, y + 1) + 1 * get_pixel(input, x + 1, y + 1);
-
-            int mag = (int)sqrt((double)(gx * gx + gy * gy));
-            if (mag > 255)
-                mag = 255;
-            if (mag < 0)
-                mag = 0;
-            set_pixel(magnitude, x, y, (unsigned char)mag);
+            int index = -1;
+
+            /* Own deque first, near end: continues our row-major sweep */
+            TileDeque *own = &deques[tid];
+            omp_set_lock(&own->lock);
+            if (own->head < own->tail)
+                index = own->head++;
+            omp_unset_lock(&own->lock);
+
+            /* Empty: steal one tile from the far end of the first victim
+               that has work. Single-tile steals keep all remaining work
+               visible in some deque, so an empty full scan means done. */
+            for (int v = 1; v < num_threads && index < 0; v++)
+            {
+                TileDeque *victim = &deques[(tid + v) % num_threads];
+                omp_set_lock(&victim->lock);
+                if (victim->head < victim->tail)
+                {
+                    index = --victim->tail;
+                    steals++;
+                }
+                omp_unset_lock(&victim->lock);
+            }
+
+            if (index < 0)
+                break;
+            run_tile_index(job, index, tiles_x);
         }
     }
+
+    for (int t = 0; t < num_threads; t++)
+        omp_destroy_lock(&deques[t].lock);
+    free(deques);
+
+    printf("Scheduled %d tiles across %d deques (%d stolen)\n",
+           num_tiles, num_threads, steals);
 }
 
 // Creates tasks for tiles of the image
 static void sobel_magnitude(const Image *input, Image *magnitude)
 {
+    if (steal_mode)
+    {
+        TileJob job = {input, magnitude, 0, false};
+        process_tiles_stealing(&job);
+        return;
+    }
+
     #pragma omp parallel
     {
         #pragma omp single
         {
             int num_tasks = 0;
             
-            for (int tile_y = 0; tile_y < input->height; tile_y += TILE_SIZE)
+            /* Row-major seeding: consecutive tasks share halo rows in cache */
+            for (int tile_y = 0; tile_y < input->height; tile_y += tile_h)
             {
-                for (int tile_x = 0; tile_x < input->width; tile_x += TILE_SIZE)
+                for (int tile_x = 0; tile_x < input->width; tile_x += tile_w)
                 {
                     int start_y = tile_y;
-                    int end_y = (tile_y + TILE_SIZE < input->height) ? tile_y + TILE_SIZE : input->height;
+                    int end_y = (tile_y + tile_h < input->height) ? tile_y + tile_h : input->height;
                     int start_x = tile_x;
-                    int end_x = (tile_x + TILE_SIZE < input->width) ? tile_x + TILE_SIZE : input->width;
+                    int end_x = (tile_x + tile_w < input->width) ? tile_x + tile_w : input->width;
                     
                     #pragma omp task firstprivate(start_y, end_y, start_x, end_x) shared(input, magnitude)
                     {
@@ -169,43 +508,475 @@ static void sobel_magnitude(const Image *input, Image *magnitude)
     }
 }
 
-static void threshold_image(const Image *src, Image *dst, unsigned char threshold)
+
+/*
+Fused Sobel + threshold: writes the binary edge byte directly instead of
+materializing the magnitude image and re-reading it in a second pass. In
+exact mode the comparison runs on gx*gx + gy*gy against the squared
+threshold ((int)sqrt(s) >= t  <=>  s >= t*t for integer t), so the fused
+kernel needs no sqrt at all; approx mode compares |gx| + |gy| directly.
+*/
+static void sobel_threshold_row_scalar(const unsigned char *row_m1, const unsigned char *row_0,
+                                       const unsigned char *row_p1, unsigned char *dst_row,
+                                       int width, int x0, int x1, int threshold)
 {
-    int n = src->width * src->height;
-    int chunk_size = 10000;  
-    
+    int threshold_sq = threshold * threshold;
+    for (int x = x0; x < x1; x++)
+    {
+        int xm1 = (x == 0) ? 0 : x - 1;
+        int xp1 = (x == width - 1) ? width - 1 : x + 1;
+
+        int gx = -row_m1[xm1] + row_m1[xp1]
+                 - 2 * row_0[xm1] + 2 * row_0[xp1]
+                 - row_p1[xm1] + row_p1[xp1];
+        int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                 + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+
+        int edge;
+        if (mag_mode == MAG_APPROX)
+            edge = (abs(gx) + abs(gy) >= threshold);
+        else
+            edge = (gx * gx + gy * gy >= threshold_sq);
+        dst_row[x] = edge ? 255 : 0;
+    }
+}
+
+static void sobel_threshold_tile(const Image *input, Image *out,
+                                 int start_y, int end_y, int start_x, int end_x,
+                                 int threshold)
+{
+    for (int y = start_y; y < end_y; y++)
+    {
+        const unsigned char *row_m1 = input->data + (size_t)((y == 0) ? 0 : y - 1) * input->width;
+        const unsigned char *row_0 = input->data + (size_t)y * input->width;
+        const unsigned char *row_p1 = input->data + (size_t)((y == input->height - 1) ? y : y + 1) * input->width;
+        unsigned char *dst_row = out->data + (size_t)y * input->width;
+
+        sobel_threshold_row_scalar(row_m1, row_0, row_p1, dst_row, input->width, start_x, end_x, threshold);
+    }
+}
+
+// One task per tile, same decomposition as sobel_magnitude(), but each
+// task writes the thresholded byte directly so no second pass is needed.
+static void sobel_threshold_image(const Image *input, Image *out, unsigned char threshold)
+{
+    if (steal_mode)
+    {
+        TileJob job = {input, out, threshold, true};
+        process_tiles_stealing(&job);
+        return;
+    }
+
     #pragma omp parallel
     {
         #pragma omp single
         {
             int num_tasks = 0;
-            
-            for (int start = 0; start < n; start += chunk_size)
+
+            /* Row-major seeding: consecutive tasks share halo rows in cache */
+            for (int tile_y = 0; tile_y < input->height; tile_y += tile_h)
             {
-                int end = (start + chunk_size < n) ? start + chunk_size : n;
-                
-                #pragma omp task firstprivate(start, end) shared(src, dst, threshold)
+                for (int tile_x = 0; tile_x < input->width; tile_x += tile_w)
                 {
-                    for (int i = start; i < end; i++)
+                    int start_y = tile_y;
+                    int end_y = (tile_y + tile_h < input->height) ? tile_y + tile_h : input->height;
+                    int start_x = tile_x;
+                    int end_x = (tile_x + tile_w < input->width) ? tile_x + tile_w : input->width;
+
+                    #pragma omp task firstprivate(start_y, end_y, start_x, end_x) shared(input, out, threshold)
                     {
-                        dst->data[i] = (src->data[i] >= threshold) ? 255 : 0;
+                        sobel_threshold_tile(input, out, start_y, end_y, start_x, end_x, threshold);
                     }
+                    num_tasks++;
                 }
-                num_tasks++;
             }
-            
+
             #pragma omp taskwait
-            printf("Created %d tasks for thresholding\n", num_tasks);
+            printf("Created %d tasks for fused Sobel+threshold\n", num_tasks);
+        }
+    }
+}
+
+
+
+/*
+Tile autotuning: time the fused kernel once per candidate shape on the
+actual input and keep the fastest. Results are cached per image size in
+TILE_CACHE_FILE so repeated runs on the same machine read the profile
+instead of re-sweeping. Differences of 25-30% between shapes are normal
+on wide images, so the sweep pays for itself after a frame or two.
+*/
+static const int tune_shapes[][2] = {
+    {64, 64}, {128, 32}, {256, 16}, {512, 8}, {32, 128}};
+#define NUM_TUNE_SHAPES (int)(sizeof(tune_shapes) / sizeof(tune_shapes[0]))
+
+static int tile_cache_lookup(int width, int height)
+{
+    FILE *file = fopen(TILE_CACHE_FILE, "r");
+    if (!file)
+        return 0;
+    int w, h, tw, th, found = 0;
+    while (fscanf(file, "%d %d %d %d", &w, &h, &tw, &th) == 4)
+    {
+        if (w == width && h == height)
+        {
+            tile_w = tw;
+            tile_h = th;
+            found = 1;
+            break;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+static void tile_cache_store(int width, int height)
+{
+    FILE *file = fopen(TILE_CACHE_FILE, "a");
+    if (!file)
+        return;
+    fprintf(file, "%d %d %d %d\n", width, height, tile_w, tile_h);
+    fclose(file);
+}
+
+static void autotune_tiles(const Image *input, Image *scratch, unsigned char threshold)
+{
+    if (tile_cache_lookup(input->width, input->height))
+    {
+        printf("Tile shape %dx%d from cached profile (%s)\n", tile_w, tile_h, TILE_CACHE_FILE);
+        return;
+    }
+
+    int best_w = tile_w, best_h = tile_h;
+    double best_time = -1.0;
+
+    /* One warmup run so the thread pool and page faults don't skew shape 0 */
+    sobel_threshold_image(input, scratch, threshold);
+
+    for (int i = 0; i < NUM_TUNE_SHAPES; i++)
+    {
+        tile_w = tune_shapes[i][0];
+        tile_h = tune_shapes[i][1];
+        double start = omp_get_wtime();
+        sobel_threshold_image(input, scratch, threshold);
+        double elapsed = omp_get_wtime() - start;
+        printf("  tile %3dx%-3d: %.6f s\n", tile_w, tile_h, elapsed);
+        if (best_time < 0 || elapsed < best_time)
+        {
+            best_time = elapsed;
+            best_w = tile_w;
+            best_h = tile_h;
         }
     }
+
+    tile_w = best_w;
+    tile_h = best_h;
+    printf("Autotuned tile shape: %dx%d\n", tile_w, tile_h);
+    tile_cache_store(input->width, input->height);
+}
+
+/*
+Phase-level instrumentation. Every binary reports the same four phases
+(decode, sobel, threshold, encode) as wall-clock seconds plus effective
+MPix/s, and --csv=<file> appends one row per phase in the schema that
+phase3/metrics.csv and phase3/performance/run_analysis.py already use
+(timestamp,latency,status,server), with server = "<binary>:<phase>".
+*/
+static const char *metrics_csv_path = NULL;
+
+static double now_seconds(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void metrics_log_phase(const char *binary, const char *phase, double seconds)
+{
+    if (!metrics_csv_path)
+        return;
+    FILE *file = fopen(metrics_csv_path, "a");
+    if (!file)
+        return;
+    if (ftell(file) == 0)
+        fprintf(file, "timestamp,latency,status,server\n");
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fprintf(file, "%.6f,%f,SUCCESS,%s:%s\n",
+            ts.tv_sec + ts.tv_nsec * 1e-9, seconds, binary, phase);
+    fclose(file);
+}
+
+static void report_phases(const char *binary, int width, int height,
+                          double decode_s, double sobel_s, double threshold_s,
+                          double encode_s)
+{
+    double mpix = (double)width * height / 1e6;
+    double total = decode_s + sobel_s + threshold_s + encode_s;
+    printf("Phase timings: decode=%.6f sobel=%.6f threshold=%.6f encode=%.6f total=%.6f s\n",
+           decode_s, sobel_s, threshold_s, encode_s, total);
+    printf("Processed %.2f MPix (%zu bytes) at %.1f MPix/s (sobel phase), %.1f MPix/s end-to-end\n",
+           mpix, (size_t)width * height,
+           sobel_s > 0 ? mpix / sobel_s : 0.0, total > 0 ? mpix / total : 0.0);
+    metrics_log_phase(binary, "decode", decode_s);
+    metrics_log_phase(binary, "sobel", sobel_s);
+    metrics_log_phase(binary, "threshold", threshold_s);
+    metrics_log_phase(binary, "encode", encode_s);
+    metrics_log_phase(binary, "total", total);
+}
+
+/*
+Batch mode: take a directory (or a text file listing one path per line)
+and process every image in one launch, so process startup and teardown is
+paid once instead of per frame.
+*/
+
+static bool has_image_extension(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot)
+        return false;
+    return strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0 ||
+           strcasecmp(dot, ".png") == 0 || strcasecmp(dot, ".pgm") == 0 ||
+           strcasecmp(dot, ".bmp") == 0;
+}
+
+/*
+Build the list of input paths: a directory is scanned for image files, a
+regular file is read as one path per line. Returns a malloc'd array of
+malloc'd strings (caller frees) and sets *count.
+*/
+static char **collect_inputs(const char *arg, int *count)
+{
+    char **paths = NULL;
+    int n = 0, cap = 0;
+
+    struct stat st;
+    if (stat(arg, &st) != 0)
+    {
+        fprintf(stderr, "Error: Cannot stat %s\n", arg);
+        return NULL;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(arg);
+        if (!dir)
+        {
+            fprintf(stderr, "Error: Cannot open directory %s\n", arg);
+            return NULL;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (!has_image_extension(entry->d_name))
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                paths = (char **)realloc(paths, cap * sizeof(char *));
+            }
+            char *full = (char *)malloc(MAX_PATH * 2);
+            snprintf(full, MAX_PATH * 2, "%s/%s", arg, entry->d_name);
+            paths[n++] = full;
+        }
+        closedir(dir);
+    }
+    else
+    {
+        FILE *file = fopen(arg, "r");
+        if (!file)
+        {
+            fprintf(stderr, "Error: Cannot open list file %s\n", arg);
+            return NULL;
+        }
+        char line[MAX_PATH];
+        while (fgets(line, sizeof(line), file))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] == '\0')
+                continue;
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                paths = (char **)realloc(paths, cap * sizeof(char *));
+            }
+            paths[n++] = strdup(line);
+        }
+        fclose(file);
+    }
+
+    *count = n;
+    return paths;
+}
+
+/* output path: <outdir>/<input basename>.pgm */
+static void make_output_path(char *dst, size_t dst_size, const char *outdir, const char *in_path)
+{
+    const char *base = strrchr(in_path, '/');
+    base = base ? base + 1 : in_path;
+    const char *dot = strrchr(base, '.');
+    int stem_len = dot ? (int)(dot - base) : (int)strlen(base);
+    snprintf(dst, dst_size, "%s/%.*s.pgm", outdir, stem_len, base);
+}
+
+static int run_batch(const char *input_arg, const char *outdir, unsigned char threshold)
+{
+    int count = 0;
+    char **paths = collect_inputs(input_arg, &count);
+    if (!paths || count == 0)
+    {
+        fprintf(stderr, "Error: No input images found in %s\n", input_arg);
+        free(paths);
+        return 1;
+    }
+
+    /* One big region up front; per-frame buffers recycle out of it */
+    image_arena_init((size_t)512 * 1024 * 1024);
+
+    printf("Batch mode: %d images, output dir %s\n", count, outdir);
+
+    if (tile_autotune && count > 0)
+    {
+        Image *first = load_image(paths[0]);
+        if (first)
+        {
+            Image *scratch = create_image(first->width, first->height, 255);
+            if (scratch)
+            {
+                autotune_tiles(first, scratch, threshold);
+                free_image(scratch);
+            }
+            free_image(first);
+        }
+    }
+
+    double batch_start = omp_get_wtime();
+    int processed = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Image *input = load_image(paths[i]);
+        if (!input)
+            continue;
+        Image *out = create_image(input->width, input->height, 255);
+        if (!out)
+        {
+            fprintf(stderr, "Error: Out of memory\n");
+            free_image(input);
+            continue;
+        }
+        sobel_threshold_image(input, out, threshold);
+
+        char out_path[MAX_PATH];
+        make_output_path(out_path, sizeof(out_path), outdir, paths[i]);
+        if (save_pgm(out_path, out) == 0)
+            processed++;
+        free_image(out);
+        free_image(input);
+    }
+    double batch_time = omp_get_wtime() - batch_start;
+    printf("Processed %d/%d images in %.3f seconds (%.1f images/s)\n",
+           processed, count, batch_time, processed / (batch_time > 0 ? batch_time : 1));
+
+    for (int i = 0; i < count; i++)
+        free(paths[i]);
+    free(paths);
+    return processed == count ? 0 : 1;
 }
 
 int main(int argc, char *argv[])
 {
+    bool magnitude_only = false;
+
+    /* Strip option flags before positional argument handling */
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--approx") == 0)
+        {
+            mag_mode = MAG_APPROX;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--magnitude") == 0)
+        {
+            magnitude_only = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--autotune") == 0)
+        {
+            tile_autotune = true;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strncmp(argv[i], "--tile=", 7) == 0)
+        {
+            int tw = 0, th = 0;
+            if (sscanf(argv[i] + 7, "%dx%d", &tw, &th) == 2 && tw > 0 && th > 0)
+            {
+                tile_w = tw;
+                tile_h = th;
+            }
+            else
+            {
+                fprintf(stderr, "Error: --tile expects WxH, e.g. --tile=256x16\n");
+                return 1;
+            }
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strncmp(argv[i], "--csv=", 6) == 0)
+        {
+            metrics_csv_path = argv[i] + 6;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+        else if (strcmp(argv[i], "--omp-tasks") == 0)
+        {
+            steal_mode = false;
+            for (int j = i; j < argc - 1; j++)
+                argv[j] = argv[j + 1];
+            argc--;
+            i--;
+        }
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "--batch") == 0)
+    {
+        unsigned char threshold = 100;
+        if (argc >= 5)
+        {
+            int t = atoi(argv[4]);
+            if (t < 0)
+                t = 0;
+            if (t > 255)
+                t = 255;
+            threshold = (unsigned char)t;
+        }
+        return run_batch(argv[2], argv[3], threshold);
+    }
+
     if (argc < 3)
     {
         fprintf(stderr, "Usage: %s <input_image> <output_image.pgm> [threshold]\n", argv[0]);
+        fprintf(stderr, "       %s --batch <input_dir|list.txt> <output_dir> [threshold]\n", argv[0]);
         fprintf(stderr, "  threshold: Edge detection threshold (default: 100)\n");
+        fprintf(stderr, "  --approx:  Integer |gx|+|gy| magnitude (no per-pixel sqrt)\n");
+        fprintf(stderr, "  --magnitude: Write raw gradient magnitudes instead of the binary map\n");
+        fprintf(stderr, "  --tile=WxH: Tile shape for the task decomposition (default %dx%d)\n", TILE_SIZE, TILE_SIZE);
+        fprintf(stderr, "  --autotune: Sweep tile shapes on the input and cache the winner\n");
+        fprintf(stderr, "  --csv=FILE: Append per-phase timings in the phase3 metrics.csv schema\n");
+        fprintf(stderr, "  --omp-tasks: Use OpenMP tasks instead of the work-stealing deques\n");
         return 1;
     }
 
@@ -221,64 +992,61 @@ int main(int argc, char *argv[])
     }
 
     printf(" OpenMP Task-Based Edge Detection \n");
-    printf("Tile size: %d x %d\n", TILE_SIZE, TILE_SIZE);
+    printf("Tile size: %d x %d\n", tile_w, tile_h);
     printf("Max threads: %d\n", omp_get_max_threads());
     printf("\n");
 
     printf("Loading image: %s\n", argv[1]);
+    double t0 = now_seconds();
     Image *input = load_image(argv[1]);
+    double decode_s = now_seconds() - t0;
     if (!input)
     {
         return 1;
     }
     printf("Image loaded: %dx%d\n", input->width, input->height);
 
-    Image *mag = create_image(input->width, input->height, 255);
-    if (!mag)
-    {
-        free_image(input);
-        fprintf(stderr, "Error: Out of memory\n");
-        return 1;
-    }
-
+    /* One output buffer: the fused kernel writes thresholded bytes directly,
+       and --magnitude fills the same buffer with raw magnitudes. */
     Image *out = create_image(input->width, input->height, 255);
     if (!out)
     {
-        free_image(mag);
         free_image(input);
         fprintf(stderr, "Error: Out of memory\n");
         return 1;
     }
 
+    if (tile_autotune && !magnitude_only)
+        autotune_tiles(input, out, threshold);
+
     // execution
     double start = omp_get_wtime();
-    
-    printf("\n Sobel Magnitude Computation \n");
-    double sobel_start = omp_get_wtime();
-    sobel_magnitude(input, mag);
-    double sobel_end = omp_get_wtime();
-    printf("Sobel time: %.6f seconds\n", sobel_end - sobel_start);
-    
-    printf("\n Thresholding \n");
-    double threshold_start = omp_get_wtime();
-    threshold_image(mag, out, threshold);
-    double threshold_end = omp_get_wtime();
-    printf("Threshold time: %.6f seconds\n", threshold_end - threshold_start);
-    
+
+    printf("\n Fused Sobel+Threshold Computation \n");
+    if (magnitude_only)
+        sobel_magnitude(input, out);
+    else
+        sobel_threshold_image(input, out, threshold);
+
     double end = omp_get_wtime();
     printf("\nTask version total runtime: %.6f seconds\n", end - start);
 
     printf("\nSaving output image: %s\n", argv[2]);
-    if (save_pgm(argv[2], out) != 0)
+    t0 = now_seconds();
+    int save_rc = save_pgm(argv[2], out);
+    double encode_s = now_seconds() - t0;
+    if (save_rc != 0)
     {
         free_image(out);
-        free_image(mag);
         free_image(input);
         return 1;
     }
 
+    /* The fused kernel folds thresholding into the sobel phase */
+    report_phases("sobel_task", input->width, input->height,
+                  decode_s, end - start, 0.0, encode_s);
+
     free_image(out);
-    free_image(mag);
     free_image(input);
     printf("Done.\n");
     return 0;
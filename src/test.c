@@ -6,6 +6,7 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <unistd.h>
 
 static double now_seconds(void) {
     struct timespec t;
@@ -13,22 +14,176 @@ static double now_seconds(void) {
     return t.tv_sec + t.tv_nsec * 1e-9;
 }
 
+
+/* ---------- Sobel characterization (modes: sobel, roofline) ---------- */
+
+/*
+Local copy of the exact Sobel row kernel (row pointers, x clamped at the
+borders) so this tool stays standalone: it measures the same arithmetic
+the production kernels run, on synthetic frames, without pulling in stb.
+*/
+static void sobel_row(const unsigned char *row_m1, const unsigned char *row_0,
+                      const unsigned char *row_p1, unsigned char *dst_row,
+                      size_t width)
+{
+    for (size_t x = 0; x < width; x++) {
+        size_t xm1 = (x == 0) ? 0 : x - 1;
+        size_t xp1 = (x == width - 1) ? width - 1 : x + 1;
+
+        int gx = -row_m1[xm1] + row_m1[xp1]
+                 - 2 * row_0[xm1] + 2 * row_0[xp1]
+                 - row_p1[xm1] + row_p1[xp1];
+        int gy = -row_m1[xm1] - 2 * row_m1[x] - row_m1[xp1]
+                 + row_p1[xm1] + 2 * row_p1[x] + row_p1[xp1];
+
+        int mag = (int)sqrt((double)(gx * gx + gy * gy));
+        if (mag > 255) mag = 255;
+        dst_row[x] = (unsigned char)mag;
+    }
+}
+
+/* Seconds for one full-frame Sobel pass over a dim x dim frame */
+static double time_sobel_frame(const unsigned char *src, unsigned char *dst, size_t dim)
+{
+    double t0 = now_seconds();
+    for (size_t y = 0; y < dim; y++) {
+        const unsigned char *row_m1 = src + (y == 0 ? 0 : y - 1) * dim;
+        const unsigned char *row_0  = src + y * dim;
+        const unsigned char *row_p1 = src + (y == dim - 1 ? y : y + 1) * dim;
+        sobel_row(row_m1, row_0, row_p1, dst + y * dim, dim);
+    }
+    return now_seconds() - t0;
+}
+
+/* Best-of-iters streaming read bandwidth in bytes/s (stride-1 over a
+   buffer much larger than LLC), the ceiling for any bandwidth-bound loop */
+static double measure_stream_bandwidth(size_t array_mb, int iters)
+{
+    size_t n_elems = array_mb * 1024ull * 1024ull / sizeof(long);
+    long *array;
+    if (posix_memalign((void **)&array, 64, n_elems * sizeof(long)) != 0)
+        return 0.0;
+    for (size_t i = 0; i < n_elems; ++i) array[i] = (long)i;
+
+    volatile long long sink = 0;
+    double best = 0.0;
+    for (int it = 0; it < iters; ++it) {
+        double t0 = now_seconds();
+        long long sum = 0;
+        for (size_t i = 0; i < n_elems; ++i) sum += array[i];
+        double dt = now_seconds() - t0;
+        sink += sum;
+        double bw = (double)(n_elems * sizeof(long)) / dt;
+        if (bw > best) best = bw;
+    }
+    (void)sink;
+    free(array);
+    return best;
+}
+
+/*
+Roofline mode: measure stream bandwidth once, then the Sobel kernel at a
+range of frame sizes. Steady-state Sobel traffic is ~2 bytes/pixel (the
+three source rows hit cache after the first touch; one input read + one
+output write go to memory), so comparing achieved bytes/s against the
+stream roof says whether the kernel is bandwidth- or compute-bound at
+each size, and what speedup ceiling threading can reach before the
+memory roof flattens it.
+*/
+static int run_roofline(int iters)
+{
+    const size_t sizes[] = {512, 1024, 2048, 4096, 8192};
+    const int num_sizes = (int)(sizeof(sizes) / sizeof(sizes[0]));
+    const int ncores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    printf("Measuring stream read bandwidth (256 MB, best of %d)...\n", iters);
+    double stream_bw = measure_stream_bandwidth(256, iters);
+    printf("Stream bandwidth: %.2f GB/s\n\n", stream_bw / 1e9);
+
+    printf("%8s %12s %12s %14s %12s %s\n",
+           "size", "sobel_s", "MPix/s", "eff_GB/s", "ceiling", "verdict");
+    for (int i = 0; i < num_sizes; ++i) {
+        size_t dim = sizes[i];
+        unsigned char *src = (unsigned char *)malloc(dim * dim);
+        unsigned char *dst = (unsigned char *)malloc(dim * dim);
+        if (!src || !dst) { free(src); free(dst); return 1; }
+        for (size_t j = 0; j < dim * dim; ++j) src[j] = (unsigned char)(j * 31);
+
+        double best = 0.0;
+        time_sobel_frame(src, dst, dim); /* warmup */
+        for (int it = 0; it < iters; ++it) {
+            double dt = time_sobel_frame(src, dst, dim);
+            if (best == 0.0 || dt < best) best = dt;
+        }
+
+        double mpix_s = (double)(dim * dim) / best / 1e6;
+        double eff_bw = 2.0 * (double)(dim * dim) / best; /* ~2 bytes/pixel DRAM traffic */
+        double bw_ceiling = stream_bw / eff_bw;            /* threads until the roof */
+        int bandwidth_bound = bw_ceiling < (double)ncores;
+        double ceiling = bandwidth_bound ? bw_ceiling : (double)ncores;
+
+        printf("%8zu %12.6f %12.1f %14.2f %12.1fx %s\n",
+               dim, best, mpix_s, eff_bw / 1e9, ceiling,
+               bandwidth_bound ? "bandwidth-bound" : "compute-bound");
+        free(src);
+        free(dst);
+    }
+    printf("\nceiling = expected speedup limit for the OpenMP/tiled variants on\n"
+           "this machine (cores when compute-bound, stream/sobel bytes when\n"
+           "bandwidth-bound). Route frames whose ceiling ~1 to fewer threads.\n");
+    return 0;
+}
+
+/* Single-size Sobel throughput measurement */
+static int run_sobel_mode(size_t dim, int iters)
+{
+    unsigned char *src = (unsigned char *)malloc(dim * dim);
+    unsigned char *dst = (unsigned char *)malloc(dim * dim);
+    if (!src || !dst) { free(src); free(dst); return 1; }
+    for (size_t j = 0; j < dim * dim; ++j) src[j] = (unsigned char)(j * 31);
+
+    time_sobel_frame(src, dst, dim);
+    for (int it = 0; it < iters; ++it) {
+        double dt = time_sobel_frame(src, dst, dim);
+        printf("  iter %2d: time=%.6fs  %.1f MPix/s  %.2f GB/s effective\n",
+               it, dt, (double)(dim * dim) / dt / 1e6,
+               2.0 * (double)(dim * dim) / dt / 1e9);
+    }
+    free(src);
+    free(dst);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         fprintf(stderr,
-            "Usage: %s <mode> [stride|block_size] [iters] [array_size_MB] [block_size]\n"
+            "Usage: %s <mode> [stride|block_size|frame_dim] [iters] [array_size_MB] [block_size]\n"
             "Modes:\n"
-            "  stride  <stride_in_elements> [iters=5] [array_MB=512]\n"
-            "  block   <block_size> [iters=5] [array_MB=512]\n"
+            "  stride   <stride_in_elements> [iters=5] [array_MB=512]\n"
+            "  block    <block_size> [iters=5] [array_MB=512]\n"
+            "  sobel    <frame_dim> [iters=5]      measure the Sobel kernel itself\n"
+            "  roofline [iters=3]                  stream roof vs Sobel at 512..8192\n"
             "Examples:\n"
             "  %s stride 1 5 512\n"
             "  %s stride 32 10 1024\n"
-            "  %s block 64 5 512\n",
-            argv[0], argv[0], argv[0], argv[0]);
+            "  %s block 64 5 512\n"
+            "  %s sobel 4096 5\n"
+            "  %s roofline\n",
+            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
     const char *mode = argv[1];
+
+    if (strcmp(mode, "roofline") == 0)
+        return run_roofline(argc >= 3 ? atoi(argv[2]) : 3);
+    if (strcmp(mode, "sobel") == 0) {
+        size_t dim = argc >= 3 ? (size_t)atol(argv[2]) : 2048;
+        int it = argc >= 4 ? atoi(argv[3]) : 5;
+        printf("Mode: sobel  frame=%zux%zu  iters=%d\n", dim, dim, it);
+        return run_sobel_mode(dim, it > 0 ? it : 1);
+    }
+
     long stride_or_bs = 1;
     int iters = 5;
     size_t array_mb = 512;